@@ -261,6 +261,14 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Set the data_ shared_ptr to a buffer of at least count() elements
+   *        that other Blob%s may also use, e.g. as planned by Net for
+   *        activations that are never live at the same time.
+   *
+   * The buffer is kept until the blob is reshaped beyond its size.
+   */
+  void ShareDataMemory(const shared_ptr<SyncedMemory>& memory);
 
   bool ShapeEquals(const BlobProto& other);
 
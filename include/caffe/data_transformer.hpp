@@ -12,6 +12,9 @@ namespace caffe {
 /**
  * @brief Applies common transformations to the input data, such as
  * scaling, mirroring, substracting the image mean...
+ *
+ * Datums with depth > 1 hold volumes and are transformed into 5-D
+ * (N x C x D x H x W) blobs.
  */
 template <typename Dtype>
 class DataTransformer {
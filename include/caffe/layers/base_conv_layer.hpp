@@ -3,10 +3,15 @@
 
 #include <vector>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/im2col.hpp"
+#include "caffe/util/workspace.hpp"
 
 namespace caffe {
 
@@ -18,7 +23,7 @@ template <typename Dtype>
 class BaseConvolutionLayer : public Layer<Dtype> {
  public:
   explicit BaseConvolutionLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param), fused_relu_(false), shared_workspace_(false) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -29,12 +34,23 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   virtual inline bool EqualNumBottomTopBlobs() const { return true; }
 
   virtual void ReleaseTemporaryBuffers() {
-    col_buffer_.ReleaseMemory();
+    // Buffers borrowed from the Workspace stay allocated for the next layer.
+    if (!shared_workspace_) {
+      col_buffer_.ReleaseMemory();
+      batch_col_buffer_.ReleaseMemory();
+      batch_output_buffer_.ReleaseMemory();
+      thread_col_buffer_.ReleaseMemory();
+    }
+    thread_weight_diff_.ReleaseMemory();
   }
 
   //TODO - it might not be efficient to release all the smaller buffers
   virtual void ReleaseAllBuffers() {
     col_buffer_.ReleaseMemory();
+    batch_col_buffer_.ReleaseMemory();
+    batch_output_buffer_.ReleaseMemory();
+    thread_col_buffer_.ReleaseMemory();
+    thread_weight_diff_.ReleaseMemory();
     bias_multiplier_.ReleaseMemory();
     kernel_shape_.ReleaseMemory();
     stride_.ReleaseMemory();
@@ -46,23 +62,25 @@ class BaseConvolutionLayer : public Layer<Dtype> {
  protected:
   // Helper functions that abstract away the column buffer and gemm arguments.
   // The last argument in forward_cpu_gemm is so that we can skip the im2col if
-  // we just called weight_cpu_gemm with the same input.
+  // we just called weight_cpu_gemm with the same input. The full helpers take
+  // an optional column buffer (col_buffer_ if NULL) so that several images can
+  // be lowered concurrently, see cpu_threads_.
   void partial_forward_cpu_gemm(const Dtype* input, const Dtype* weights, Dtype* output);
-  void full_forward_cpu_gemm(const Dtype* input, const Dtype* weights, Dtype* output, bool skip_im2col);
+  void full_forward_cpu_gemm(const Dtype* input, const Dtype* weights, Dtype* output, bool skip_im2col, Dtype* col_data = NULL);
   inline void forward_cpu_gemm(const Dtype* input, const Dtype* weights, Dtype* output, bool skip_im2col = false) {
     if(partial_conv_lower_) partial_forward_cpu_gemm(input, weights, output);
     else full_forward_cpu_gemm(input, weights, output, skip_im2col);
   }
 
   void partial_backward_cpu_gemm(const Dtype* input, const Dtype* weights, Dtype* output);
-  void full_backward_cpu_gemm(const Dtype* input, const Dtype* weights, Dtype* output);
+  void full_backward_cpu_gemm(const Dtype* input, const Dtype* weights, Dtype* output, Dtype* col_data = NULL);
   inline void backward_cpu_gemm(const Dtype* input, const Dtype* weights, Dtype* output) {
     if(partial_conv_lower_) partial_backward_cpu_gemm(input, weights, output);
     else full_backward_cpu_gemm(input, weights, output);
   }
 
   void partial_weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype* weights);
-  void full_weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype* weights);
+  void full_weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype* weights, Dtype* col_data = NULL);
   inline void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype* weights) {
     if(partial_conv_lower_) partial_weight_cpu_gemm(input, output, weights);
     else full_weight_cpu_gemm(input, output, weights);
@@ -70,7 +88,35 @@ class BaseConvolutionLayer : public Layer<Dtype> {
 
   void forward_cpu_bias(Dtype* output, const Dtype* bias);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
+  // In-place max(0, x) over one image's output, when fused_relu_.
+  void forward_cpu_relu(Dtype* output);
 
+  // Batched variants of the above for batch consecutive images (bottom_dim_
+  // and top_dim_ apart): the images are lowered side by side so that each
+  // group is a single GEMM with batch * conv_out_spatial_dim_ columns. A batch
+  // of one uses the per-image helpers. See gemm_batch_.
+  void forward_cpu_gemm_batch(const Dtype* input, const Dtype* weights,
+      Dtype* output, const int batch);
+  void backward_cpu_gemm_batch(const Dtype* output, const Dtype* weights,
+      Dtype* input, const int batch);
+  void weight_cpu_gemm_batch(const Dtype* input, const Dtype* output,
+      Dtype* weights, const int batch);
+
+  // Scratch for the OpenMP loops over the batch (cpu_threads_ > 1), fetched
+  // before entering the parallel region: one column buffer per thread (NULL
+  // for 1x1, which needs none), and cpu_threads_ zeroed weight gradients of
+  // blobs_[0]->count() each that reduce_thread_weight_diffs then sums into
+  // weight_diff.
+  const vector<Dtype*>& thread_col_buffers();
+  Dtype* thread_weight_diffs();
+  void reduce_thread_weight_diffs(const Dtype* thread_diffs, Dtype* weight_diff);
+  static inline int cpu_thread_num() {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+  }
 
 #ifndef CPU_ONLY
   void partial_forward_gpu_gemm(const Dtype* input, const Dtype* weights, Dtype* output);
@@ -137,14 +183,22 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int out_spatial_dim_;
   int weight_offset_;
   int num_output_;
+  /// @brief Images per batched CPU GEMM, from gemm_batch_memory (1 if off).
+  int gemm_batch_;
+  /// @brief Threads the CPU passes spread the images over, from cpu_threads
+  ///        (1 without OpenMP, with partial_conv_lower or with gemm_batch_ > 1).
+  int cpu_threads_;
   bool partial_conv_lower_;
   bool bias_term_;
   bool is_1x1_;
   bool force_nd_im2col_;
+  /// @brief Whether the forward pass ends with a ReLU, from fused_relu.
+  bool fused_relu_;
 
- private:
-  // wrap im2col/col2im so we don't have to remember the (long) argument lists
-  inline void conv_im2col_cpu(const Dtype* data, Dtype* col_buff) {
+  // wrap im2col/col2im so we don't have to remember the (long) argument lists;
+  // im2col also lowers the int8 data of QuantizedConvolutionLayer
+  template <typename T>
+  inline void conv_im2col_cpu(const T* data, T* col_buff) {
     if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
       im2col_cpu(data, conv_in_channels_,
           conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
@@ -152,12 +206,23 @@ class BaseConvolutionLayer : public Layer<Dtype> {
           pad_.cpu_data()[0], pad_.cpu_data()[1],
           stride_.cpu_data()[0], stride_.cpu_data()[1],
           dilation_.cpu_data()[0], dilation_.cpu_data()[1], col_buff);
+    } else if (!force_nd_im2col_ && num_spatial_axes_ == 3) {
+      im2col_3d_cpu(data, conv_in_channels_,
+          conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+          conv_input_shape_.cpu_data()[3],
+          kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+          kernel_shape_.cpu_data()[2],
+          pad_.cpu_data()[0], pad_.cpu_data()[1], pad_.cpu_data()[2],
+          stride_.cpu_data()[0], stride_.cpu_data()[1], stride_.cpu_data()[2],
+          dilation_.cpu_data()[0], dilation_.cpu_data()[1],
+          dilation_.cpu_data()[2], col_buff);
     } else {
       im2col_nd_cpu(data, num_spatial_axes_, conv_input_shape_.cpu_data(),
           col_buffer_shape_.data(), kernel_shape_.cpu_data(),
           pad_.cpu_data(), stride_.cpu_data(), dilation_.cpu_data(), col_buff);
     }
   }
+ private:
   inline void conv_col2im_cpu(const Dtype* col_buff, Dtype* data) {
     if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
       col2im_cpu(col_buff, conv_in_channels_,
@@ -166,6 +231,16 @@ class BaseConvolutionLayer : public Layer<Dtype> {
           pad_.cpu_data()[0], pad_.cpu_data()[1],
           stride_.cpu_data()[0], stride_.cpu_data()[1],
           dilation_.cpu_data()[0], dilation_.cpu_data()[1], data);
+    } else if (!force_nd_im2col_ && num_spatial_axes_ == 3) {
+      col2im_3d_cpu(col_buff, conv_in_channels_,
+          conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+          conv_input_shape_.cpu_data()[3],
+          kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+          kernel_shape_.cpu_data()[2],
+          pad_.cpu_data()[0], pad_.cpu_data()[1], pad_.cpu_data()[2],
+          stride_.cpu_data()[0], stride_.cpu_data()[1], stride_.cpu_data()[2],
+          dilation_.cpu_data()[0], dilation_.cpu_data()[1],
+          dilation_.cpu_data()[2], data);
     } else {
       col2im_nd_cpu(col_buff, num_spatial_axes_, conv_input_shape_.cpu_data(),
           col_buffer_shape_.data(), kernel_shape_.cpu_data(),
@@ -205,8 +280,20 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   }
 #endif
 
-  void get_col_from_row_major_matrix(const Dtype* matrix, Dtype* col_result, int len_row, int num_rows, int len_col, int col_number);
-  void add_col_to_row_major_matrix(Dtype* matrix, Dtype* add_col, int len_row, int num_rows, int len_col, int col_number);
+  // im2col/col2im restricted to a slab of tile_rows rows of the outermost
+  // (column buffer) spatial axis starting at tile_start; used by the tiled
+  // partial convolution. A single tile covering every row falls back to the
+  // plain conv_im2col_cpu/conv_col2im_cpu.
+  void conv_im2col_tile_cpu(const Dtype* data, const int tile_start,
+      const int tile_rows, Dtype* col_buff);
+  void conv_col2im_tile_cpu(const Dtype* col_buff, const int tile_start,
+      const int tile_rows, Dtype* data);
+  // im2col/col2im of batch images to/from a [kernel_dim_ * group_,
+  // batch * conv_out_spatial_dim_] column matrix, going through col_buffer_.
+  void conv_im2col_batch_cpu(const Dtype* data, const int batch,
+      Dtype* batch_col_buff);
+  void conv_col2im_batch_cpu(const Dtype* batch_col_buff, const int batch,
+      Dtype* data);
 
   int num_kernels_im2col_;
   int num_kernels_col2im_;
@@ -216,8 +303,25 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int kernel_dim_;
   int col_offset_;
   int output_offset_;
+  // Tiling of the partial convolution: the column buffer covers
+  // partial_tile_rows_ of the conv_out_outer_dim_ slabs (each
+  // conv_out_inner_dim_ positions) of the convolution output.
+  int partial_tile_rows_;
+  int conv_out_outer_dim_;
+  int conv_out_inner_dim_;
+
+  // Point buffer at the shared Workspace slot when shared_workspace_.
+  void borrow_workspace(const Workspace::Slot slot, Blob<Dtype>* buffer);
+  bool shared_workspace_;
 
   Blob<Dtype> col_buffer_;
+  // Column and output matrices of the batched CPU GEMM (gemm_batch_ > 1).
+  Blob<Dtype> batch_col_buffer_;
+  Blob<Dtype> batch_output_buffer_;
+  // Per-thread column buffers and weight gradients (cpu_threads_ > 1).
+  Blob<Dtype> thread_col_buffer_;
+  Blob<Dtype> thread_weight_diff_;
+  vector<Dtype*> thread_col_buffers_;
   Blob<Dtype> bias_multiplier_;
 };
 
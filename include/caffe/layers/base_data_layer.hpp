@@ -47,6 +47,8 @@ template <typename Dtype>
 class Batch {
  public:
   Blob<Dtype> data_, label_;
+  // Blobs for the tops after data and label, for layers with more than two.
+  vector<shared_ptr<Blob<Dtype> > > extra_;
 };
 
 template <typename Dtype>
@@ -29,10 +29,44 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   void Next();
   bool Skip();
   virtual void load_batch(Batch<Dtype>* batch);
+  // load_batch with data_param.cache set.
+  void load_cached_batch(Batch<Dtype>* batch);
+  void NewTransformers(const TransformationParameter& param,
+      vector<shared_ptr<DataTransformer<Dtype> > >* transformers);
+  // Points values_[item_id] at the current value of the cursor, copied if
+  // the cursor's view would not survive the moves to the next items.
+  void ViewValue(int item_id);
 
   shared_ptr<db::DB> db_;
   shared_ptr<db::Cursor> cursor_;
   uint64_t offset_;
+  // One transformer per decode thread, transformers_[0] being
+  // data_transformer_ unless caching, and the items of the batch being loaded.
+  vector<shared_ptr<DataTransformer<Dtype> > > transformers_;
+  vector<Datum> datums_;
+  // The serialized items of the batch being loaded, parsed by the decode
+  // threads, and the copies holding them if !cursor_->stable_views().
+  vector<const char*> values_;
+  vector<size_t> value_sizes_;
+  vector<string> value_copies_;
+
+  // The cache: cache_items_ items of shape cache_shape_, stored one after
+  // the other in cache_data_ once cache_transformers_ have applied the
+  // deterministic transformations to them. transformers_ then only crop and
+  // mirror, and are skipped if cache_copy_. The DB has been read once
+  // cache_full_, and cache_order_[cache_pos_] is the next item served.
+  vector<shared_ptr<DataTransformer<Dtype> > > cache_transformers_;
+  vector<int> cache_shape_;
+  vector<Dtype> cache_data_;
+  vector<Dtype> cache_labels_;
+  int cache_items_;
+  bool cache_copy_;
+  bool cache_full_;
+  vector<int> cache_order_;
+  int cache_pos_;
+  // The cached items of the batch being loaded.
+  vector<int> batch_items_;
+  shared_ptr<Caffe::RNG> prefetch_rng_;
 };
 
 }  // namespace caffe
@@ -0,0 +1,67 @@
+#ifndef CAFFE_FUSED_ELEMENTWISE_LAYER_HPP_
+#define CAFFE_FUSED_ELEMENTWISE_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief Applies a chain of element-wise layers in a single pass, as
+ *        generated by NetParameter.fuse_elementwise for the TEST phase.
+ *
+ * The chain (fused_elementwise_param.layer) starts with an Eltwise, a Scale
+ * or Bias with a learned per-channel parameter (axis 1, num_axes 1), or a
+ * neuron layer, followed by the ReLU, Sigmoid, TanH, AbsVal, Power and ELU
+ * neuron layers; see FuseElementwiseLayers. The output is computed tile_size
+ * elements at a time through the whole chain, so each tile is read and written
+ * once from memory instead of once per layer. The blobs are those of the first
+ * layer. There is no backward pass.
+ */
+template <typename Dtype>
+class FusedElementwiseLayer : public Layer<Dtype> {
+ public:
+  explicit FusedElementwiseLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "FusedElementwise"; }
+  virtual inline int MinBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+    NOT_IMPLEMENTED;
+  }
+
+  // Compute the first layer over count elements starting at offset, of
+  // channel c (for Scale and Bias).
+  void forward_head(const vector<Blob<Dtype>*>& bottom, const int offset,
+      const int count, const int c, Dtype* output);
+  // Apply the neuron layer param in place to count elements.
+  static void forward_neuron(const LayerParameter& param, const int count,
+      Dtype* data);
+
+  /// @brief The parameters of the fused layers, first one included.
+  vector<LayerParameter> layers_;
+  int tile_size_;
+  // Split of the output for the per-channel first layers:
+  // outer_dim_ x channels_ x inner_dim_ (1 x 1 x count otherwise).
+  int outer_dim_;
+  int channels_;
+  int inner_dim_;
+  vector<Dtype> coeffs_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_FUSED_ELEMENTWISE_LAYER_HPP_
@@ -17,19 +17,21 @@ namespace caffe {
 /**
  * @brief Provides data to the Net from HDF5 files.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * Batches are assembled on the prefetch thread of BasePrefetchingDataLayer.
+ * Rows are read chunk_size at a time (whole files by default) as hyperslabs
+ * on a separate reader thread, which fills the next chunk -- possibly of the
+ * next file -- while the current one is consumed, so neither file switches
+ * nor file sizes stall the solver.
  */
 template <typename Dtype>
-class HDF5DataLayer : public Layer<Dtype> {
+class HDF5DataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
   explicit HDF5DataLayer(const LayerParameter& param)
-      : Layer<Dtype>(param), offset_() {}
+      : BasePrefetchingDataLayer<Dtype>(param), chunk_current_(),
+        single_chunk_(), offset_() {}
   virtual ~HDF5DataLayer();
-  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
-  // Data layers have no bottoms, so reshaping is trivial.
-  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top) {}
 
   virtual inline const char* type() const { return "HDF5Data"; }
   virtual inline int ExactNumBottomBlobs() const { return 0; }
@@ -44,24 +46,37 @@ class HDF5DataLayer : public Layer<Dtype> {
  protected:
   void Next();
   bool Skip();
-
-  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top);
-  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top);
-  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
-      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
-  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
-      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
-  virtual void LoadHDF5FileData(const char* filename);
+  virtual void load_batch(Batch<Dtype>* batch);
+  // Reads the chunk at the read position into chunk and advances the position.
+  virtual void LoadHDF5ChunkData(Batch<Dtype>* chunk);
+  // Body of the reader thread, filling free chunks in turn.
+  void ReadChunks(int device);
+  // Releases the current chunk and takes the next one read.
+  void NextChunk();
+  // Restarts the current chunk in a new (shuffled if needed) row order.
+  void ResetRows();
+  void StopReader();
 
   std::vector<std::string> hdf_filenames_;
   unsigned int num_files_;
-  unsigned int current_file_;
   hsize_t current_row_;
-  std::vector<shared_ptr<Blob<Dtype> > > hdf_blobs_;
+  // Chunks hold the rows of every top as a Batch does, the one being consumed
+  // being chunk_current_.
+  vector<shared_ptr<Batch<Dtype> > > chunks_;
+  BlockingQueue<Batch<Dtype>*> chunk_free_;
+  BlockingQueue<Batch<Dtype>*> chunk_full_;
+  Batch<Dtype>* chunk_current_;
   std::vector<unsigned int> data_permutation_;
   std::vector<unsigned int> file_permutation_;
+  // Read position: index into file_permutation_ and first row of the chunk.
+  unsigned int read_file_;
+  hsize_t read_row_;
+  // Shuffles the files, on the reader thread once it runs; the rows are
+  // shuffled with the RNG of the thread consuming them.
+  shared_ptr<Caffe::RNG> file_rng_;
+  // Whether all the data fit in one chunk, which then stays current.
+  bool single_chunk_;
+  shared_ptr<boost::thread> reader_;
   uint64_t offset_;
 };
 
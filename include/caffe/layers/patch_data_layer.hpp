@@ -0,0 +1,79 @@
+#ifndef CAFFE_PATCH_DATA_LAYER_HPP_
+#define CAFFE_PATCH_DATA_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/base_data_layer.hpp"
+
+namespace boost { namespace interprocess { class mapped_region; } }
+
+namespace caffe {
+
+/**
+ * @brief Provides random patches of large 3-D volumes and of their label
+ *        volumes to the Net, for segmentation.
+ *
+ * The volumes, raw files or contiguous HDF5 datasets, are memory-mapped
+ * rather than loaded, and each batch is cropped from them on the prefetch
+ * thread. fg_fraction of the patches are centered on a foreground voxel
+ * and the others on a background voxel; patches reaching past a volume
+ * border are padded with 0 and background_label. The data top is
+ * N x C x D x H x W and the label top N x 1 x D' x H' x W'.
+ *
+ * transform_param only supports scale and mean_value.
+ */
+template <typename Dtype>
+class PatchDataLayer : public BasePrefetchingDataLayer<Dtype> {
+ public:
+  explicit PatchDataLayer(const LayerParameter& param)
+      : BasePrefetchingDataLayer<Dtype>(param) {}
+  virtual ~PatchDataLayer();
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "PatchData"; }
+  virtual inline int ExactNumBottomBlobs() const { return 0; }
+  virtual inline int ExactNumTopBlobs() const { return 2; }
+
+ protected:
+  struct Volume {
+    // The mappings, which keep data and label valid.
+    shared_ptr<boost::interprocess::mapped_region> data_map, label_map;
+    const char* data;
+    const char* label;
+    PatchDataParameter::VoxelType data_type, label_type;
+    int channels;
+    int shape[3];
+    // Bounding box [fg_begin, fg_end) of the foreground voxels.
+    int fg_begin[3], fg_end[3];
+    bool has_fg;
+  };
+
+  virtual unsigned int PrefetchRand();
+  virtual void load_batch(Batch<Dtype>* batch);
+  void MapRawVolume(const string& data_file, const string& label_file,
+      const vector<int>& shape, Volume* volume);
+  void MapHDF5Volume(const string& file, Volume* volume);
+  // Picks a random voxel of the volume with a foreground or background label.
+  void SampleCenter(const Volume& volume, bool foreground, int* center);
+  // Copies the patch of the given shape at origin out of the image, or out
+  // of the label volume, applying scale and mean_value to the image.
+  void CopyPatch(const Volume& volume, bool label, const int* origin,
+      const int* shape, Dtype* patch);
+
+  shared_ptr<Caffe::RNG> prefetch_rng_;
+  vector<Volume> volumes_;
+  // Indices of the volumes having foreground voxels.
+  vector<int> fg_volumes_;
+  int patch_shape_[3];
+  int label_shape_[3];
+  vector<Dtype> mean_values_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_PATCH_DATA_LAYER_HPP_
@@ -12,6 +12,10 @@ namespace caffe {
 /**
  * @brief Pools the input image by taking the max, average, etc. within regions.
  *
+ * Besides (num, channels, height, width) blobs, inputs with one to three
+ * spatial axes (e.g. 5-D num, channels, depth, height, width volumes) are
+ * pooled on the CPU with per-axis kernel_nd, stride_nd and pad_nd.
+ *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
  */
 template <typename Dtype>
@@ -48,6 +52,16 @@ class PoolingLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  // CPU pooling over up to three spatial axes; used for inputs that are not
+  // 4-D and for stochastic pooling. Masks index the bottom within a channel.
+  void Forward_cpu_nd(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void Backward_cpu_nd(const vector<Blob<Dtype>*>& top,
+      const vector<Blob<Dtype>*>& bottom);
+  // Clipped [start, end) of the input window of pooled position index within
+  // its channel, per (depth, height, width) axis; returns the window size
+  // including padding.
+  int PoolWindowND(int index, int* start, int* end) const;
 
   int kernel_h_, kernel_w_;
   int stride_h_, stride_w_;
@@ -55,6 +69,12 @@ class PoolingLayer : public Layer<Dtype> {
   int channels_;
   int height_, width_;
   int pooled_height_, pooled_width_;
+  int num_spatial_axes_;
+  /// @brief The geometry of the spatial axes right-aligned to (depth, height,
+  ///        width); missing leading axes have size 1. The 2-D members above
+  ///        mirror the last two entries.
+  vector<int> kernel_nd_, stride_nd_, pad_nd_;
+  vector<int> input_nd_, pooled_nd_;
   bool global_pooling_;
   Blob<Dtype> rand_idx_;
   Blob<int> max_idx_;
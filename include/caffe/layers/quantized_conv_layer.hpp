@@ -0,0 +1,48 @@
+#ifndef CAFFE_QUANTIZED_CONV_LAYER_HPP_
+#define CAFFE_QUANTIZED_CONV_LAYER_HPP_
+
+#include <stdint.h>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/conv_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief int8 CPU inference implementation of ConvolutionLayer, selected for
+ *        the TEST phase by a nonzero quantization_param.input_range.
+ *
+ * Each image is quantized to int8 with the calibrated input range and lowered
+ * by im2col in int8; the filters are quantized per output channel on the
+ * first Forward. The GEMM accumulates in int32, and the result is rescaled to
+ * Dtype with the bias added. The backward pass and the GPU passes are those
+ * of ConvolutionLayer.
+ */
+template <typename Dtype>
+class QuantizedConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit QuantizedConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param), weights_quantized_(false) {}
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  void quantize_weights();
+
+  bool weights_quantized_;
+  vector<int8_t> weight_q_;
+  /// @brief The scale of each output channel of weight_q_.
+  vector<Dtype> weight_scale_;
+  vector<int8_t> input_q_;
+  vector<int8_t> col_q_;
+  vector<int32_t> output_q_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_QUANTIZED_CONV_LAYER_HPP_
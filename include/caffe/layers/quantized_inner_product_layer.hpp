@@ -0,0 +1,47 @@
+#ifndef CAFFE_QUANTIZED_INNER_PRODUCT_LAYER_HPP_
+#define CAFFE_QUANTIZED_INNER_PRODUCT_LAYER_HPP_
+
+#include <stdint.h>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/inner_product_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief int8 CPU inference implementation of InnerProductLayer, selected
+ *        for the TEST phase by a nonzero quantization_param.input_range.
+ *
+ * The input is quantized to int8 with the calibrated input range and the
+ * weights per output on the first Forward; the product accumulates in int32
+ * and is rescaled to Dtype with the bias added. The backward pass and the GPU
+ * passes are those of InnerProductLayer.
+ */
+template <typename Dtype>
+class QuantizedInnerProductLayer : public InnerProductLayer<Dtype> {
+ public:
+  explicit QuantizedInnerProductLayer(const LayerParameter& param)
+      : InnerProductLayer<Dtype>(param), weights_quantized_(false) {}
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  void quantize_weights();
+
+  bool weights_quantized_;
+  /// @brief The quantized weights, K_ x N_ whatever transpose_ is.
+  vector<int8_t> weight_q_;
+  /// @brief The scale of each output of weight_q_.
+  vector<Dtype> weight_scale_;
+  vector<int8_t> input_q_;
+  vector<int32_t> output_q_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_QUANTIZED_INNER_PRODUCT_LAYER_HPP_
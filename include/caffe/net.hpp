@@ -115,10 +115,20 @@ class Net {
   void CopyTrainedLayersFrom(const string trained_filename);
   void CopyTrainedLayersFromBinaryProto(const string trained_filename);
   void CopyTrainedLayersFromHDF5(const string trained_filename);
+  /**
+   * @brief Points the params at a memory-mapped weights file written by
+   *        ToMappedWeights, without reading or copying them.
+   *
+   * The mapping is copy-on-write, so processes mapping the same file share
+   * its pages until they modify the weights.
+   */
+  void MapTrainedLayersFrom(const string trained_filename);
   /// @brief Writes the net to a proto.
   void ToProto(NetParameter* param, bool write_diff = false) const;
   /// @brief Writes the net to an HDF5 file.
   void ToHDF5(const string& filename, bool write_diff = false) const;
+  /// @brief Writes the weights to a flat file for MapTrainedLayersFrom.
+  void ToMappedWeights(const string& filename) const;
 
   /// @brief returns the network name.
   inline const string& name() const { return name_; }
@@ -266,6 +276,16 @@ class Net {
   /// @brief Append a new parameter blob to the net.
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
+  /// @brief Map each blob to a representative of the blobs sharing its data.
+  void BlobAliases(vector<int>* alias) const;
+  /// @brief Assign the intermediate top blobs to shared buffers by liveness.
+  void PlanActivationMemory();
+  /// @brief Find the checkpoint segments and the activations they recompute.
+  void PlanCheckpoints();
+  /// @brief Release the recomputable activations of a checkpoint segment.
+  void ReleaseSegment(const int segment);
+  /// @brief Recompute the released activations of a checkpoint segment.
+  void RecomputeSegment(const int segment);
 
   /// @brief Helper for displaying debug info in Forward.
   void ForwardDebugInfo(const int layer_id);
@@ -330,6 +350,19 @@ class Net {
 
   /// The bytes of memory used by this net
   size_t memory_used_;
+  /// The mappings of MapTrainedLayersFrom, which the params point into.
+  vector<shared_ptr<void> > mapped_weights_;
+  /// Buffers shared by activations when share_activation_memory is set.
+  vector<shared_ptr<SyncedMemory> > activation_memory_;
+  /// Checkpoint segment of each layer, or -1 after the last checkpoint.
+  vector<int> layer_segment_;
+  /// The first and the (checkpoint) last layer of each segment.
+  vector<int> segment_begin_, segment_end_;
+  /// The blobs each segment releases and the layers that recompute them.
+  vector<vector<int> > segment_release_blobs_;
+  vector<vector<int> > segment_recompute_layers_;
+  /// Whether a segment's activations are released and need recomputing.
+  vector<bool> segment_released_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
   // Callbacks
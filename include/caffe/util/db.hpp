@@ -18,8 +18,21 @@ class Cursor {
   virtual void Next() = 0;
   virtual string key() = 0;
   virtual string value() = 0;
+  // The current value as a view of the backend's own buffer, valid until the
+  // cursor moves, which saves the copy of value(). The default holds a copy.
+  virtual void value_view(const char** data, size_t* size) {
+    value_copy_ = value();
+    *data = value_copy_.data();
+    *size = value_copy_.size();
+  }
+  // Whether the views stay valid as the cursor moves on, for as long as the
+  // cursor lives.
+  virtual bool stable_views() { return false; }
   virtual bool valid() = 0;
 
+ private:
+  string value_copy_;
+
   DISABLE_COPY_AND_ASSIGN(Cursor);
 };
 
@@ -34,6 +34,12 @@ class LMDBCursor : public Cursor {
     return string(static_cast<const char*>(mdb_value_.mv_data),
         mdb_value_.mv_size);
   }
+  virtual void value_view(const char** data, size_t* size) {
+    *data = static_cast<const char*>(mdb_value_.mv_data);
+    *size = mdb_value_.mv_size;
+  }
+  // The values live in the map for the whole read transaction.
+  virtual bool stable_views() { return true; }
   virtual bool valid() { return valid_; }
 
  private:
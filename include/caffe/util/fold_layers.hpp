@@ -0,0 +1,29 @@
+#ifndef CAFFE_UTIL_FOLD_LAYERS_HPP_
+#define CAFFE_UTIL_FOLD_LAYERS_HPP_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy an inference NetParameter (with its trained blobs) with the BatchNorm,
+// Scale and Bias layers that directly follow a Convolution folded into its
+// weights and bias, and a following ReLU (negative_slope 0) merged into it as
+// fused_relu. A layer is folded when it reads the convolution output in place
+// or as its only consumer, and its statistics or parameters are per channel.
+void FoldInferenceLayers(const NetParameter& param, NetParameter* param_folded);
+
+// Copy a NetParameter with each chain of element-wise layers replaced by one
+// FusedElementwise layer named after the first layer of the chain, which
+// keeps its bottoms and parameters. A chain is a layer for which
+// StartsElementwiseChain holds followed by at least one for which
+// ContinuesElementwiseChain does, each reading the previous output in place or
+// as its only consumer.
+void FuseElementwiseLayers(const NetParameter& param,
+    NetParameter* param_fused);
+
+bool StartsElementwiseChain(const LayerParameter& param);
+bool ContinuesElementwiseChain(const LayerParameter& param);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FOLD_LAYERS_HPP_
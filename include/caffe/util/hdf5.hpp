@@ -8,8 +8,16 @@
 
 #include "caffe/blob.hpp"
 
+namespace boost { class recursive_mutex; }
+
 namespace caffe {
 
+// Serializes the HDF5 calls of Caffe, which data reader threads make while
+// the solver snapshots or restores, as builds of the library are generally
+// not thread-safe. The functions below take it; take it as well around any
+// other HDF5 calls, from opening a file to closing it.
+boost::recursive_mutex& hdf5_mutex();
+
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
@@ -20,11 +28,19 @@ void hdf5_load_nd_dataset(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
     Blob<Dtype>* blob, bool reshape = false);
 
+// Loads rows [row_begin, row_begin + num_rows) of the dataset, i.e. a
+// hyperslab along its first axis, reshaping blob accordingly.
+template <typename Dtype>
+void hdf5_load_nd_dataset_rows(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+    hsize_t row_begin, int num_rows, Blob<Dtype>* blob);
+
 template <typename Dtype>
 void hdf5_save_nd_dataset(
     const hid_t file_id, const string& dataset_name, const Blob<Dtype>& blob,
     bool write_diff = false);
 
+vector<int> hdf5_get_dataset_shape(hid_t loc_id, const string& dataset_name);
 int hdf5_load_int(hid_t loc_id, const string& dataset_name);
 void hdf5_save_int(hid_t loc_id, const string& dataset_name, int i);
 string hdf5_load_string(hid_t loc_id, const string& dataset_name);
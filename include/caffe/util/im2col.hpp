@@ -16,12 +16,40 @@ void im2col_cpu(const Dtype* data_im, const int channels,
     const int stride_w, const int dilation_h, const int dilation_w,
     Dtype* data_col);
 
+// 3-D counterparts of im2col_cpu/col2im_cpu for (channels, depth, height,
+// width) images, used instead of the ND versions for volumetric convolution.
+template <typename Dtype>
+void im2col_3d_cpu(const Dtype* data_im, const int channels,
+    const int depth, const int height, const int width,
+    const int kernel_d, const int kernel_h, const int kernel_w,
+    const int pad_d, const int pad_h, const int pad_w,
+    const int stride_d, const int stride_h, const int stride_w,
+    const int dilation_d, const int dilation_h, const int dilation_w,
+    Dtype* data_col);
+
+template <typename Dtype>
+void col2im_3d_cpu(const Dtype* data_col, const int channels,
+    const int depth, const int height, const int width,
+    const int kernel_d, const int kernel_h, const int kernel_w,
+    const int pad_d, const int pad_h, const int pad_w,
+    const int stride_d, const int stride_h, const int stride_w,
+    const int dilation_d, const int dilation_h, const int dilation_w,
+    Dtype* data_im);
+
 template <typename Dtype>
 void col2im_nd_cpu(const Dtype* data_col, const int num_spatial_axes,
     const int* im_shape, const int* col_shape,
     const int* kernel_shape, const int* pad, const int* stride,
     const int* dilation, Dtype* data_im);
 
+// Like col2im_nd_cpu, but accumulates into data_im instead of overwriting it,
+// so a column buffer may be folded back piecewise (e.g. one tile at a time).
+template <typename Dtype>
+void col2im_nd_add_cpu(const Dtype* data_col, const int num_spatial_axes,
+    const int* im_shape, const int* col_shape,
+    const int* kernel_shape, const int* pad, const int* stride,
+    const int* dilation, Dtype* data_im);
+
 template <typename Dtype>
 void col2im_cpu(const Dtype* data_col, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
@@ -0,0 +1,27 @@
+#ifndef CAFFE_UTIL_QUANTIZE_HPP_
+#define CAFFE_UTIL_QUANTIZE_HPP_
+
+#include <stdint.h>
+
+namespace caffe {
+
+// Symmetric int8 quantization: a real value x is stored as round(x / scale)
+// saturated to [-127, 127], with scale = (largest magnitude) / 127.
+
+/// @brief The largest magnitude of x.
+template <typename Dtype>
+Dtype caffe_cpu_amax(const int n, const Dtype* x);
+
+/// @brief y = round(x / scale), saturated to [-127, 127].
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype* x, const Dtype scale,
+    int8_t* y);
+
+/// @brief C = A * B for row-major int8 A (M x K) and B (K x N), accumulated
+///        in int32.
+void caffe_cpu_gemm_int8(const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, int32_t* C);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_QUANTIZE_HPP_
@@ -0,0 +1,35 @@
+#ifndef CAFFE_UTIL_WORKSPACE_HPP_
+#define CAFFE_UTIL_WORKSPACE_HPP_
+
+#include <cstddef>
+
+#include "caffe/common.hpp"
+#include "caffe/syncedmem.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Scratch memory shared by the layers running on the calling thread.
+ *
+ * A net runs one layer at a time, so layers that need scratch only during
+ * their own Forward/Backward (e.g. the convolution column buffers) can borrow
+ * it here instead of each keeping a buffer of its own. Each thread holds one
+ * buffer per slot, grown to the largest request; a layer uses different
+ * slots for buffers it needs at the same time.
+ */
+class Workspace {
+ public:
+  enum Slot { COLUMN, BATCH_COLUMN, BATCH_OUTPUT, THREAD_COLUMN, NUM_SLOTS };
+
+  /// @brief The calling thread's buffer for slot, of at least size bytes.
+  static shared_ptr<SyncedMemory> Get(const Slot slot, const size_t size);
+  /// @brief The bytes held by the calling thread's buffers.
+  static size_t size();
+  /// @brief Drop the calling thread's buffers; layers still holding one keep
+  ///        it until they borrow again.
+  static void Release();
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WORKSPACE_HPP_
@@ -5,29 +5,128 @@
  *      Author: z003arva
  */
 
+#include <algorithm>
+#include <cmath>
+
 #include "CaffeAPI.h"
 
-Caffe_API::Caffe_API() {
+// Tile edge of the blocked plane copy: the kTile cache lines of the strided
+// side of a tile stay in L1 while the dense side is written.
+static const int kTile = 16;
+
+// dst[i * dst_i + j] = src[i * src_i + j * src_j] for i < rows, j < cols.
+static void copyPlane(const int rows,const int cols,const float* src,
+		const int src_i,const int src_j,float* dst,const int dst_i){
+	if (src_j == 1) {
+		for (int i = 0; i < rows; ++i) {
+			caffe_copy(cols, src + i * src_i, dst + i * dst_i);
+		}
+		return;
+	}
+	for (int i0 = 0; i0 < rows; i0 += kTile) {
+		const int i1 = std::min(rows, i0 + kTile);
+		for (int j0 = 0; j0 < cols; j0 += kTile) {
+			const int j1 = std::min(cols, j0 + kTile);
+			for (int i = i0; i < i1; ++i) {
+				const float* src_row = src + i * src_i;
+				float* dst_row = dst + i * dst_i;
+				for (int j = j0; j < j1; ++j) {
+					dst_row[j] = src_row[j * src_j];
+				}
+			}
+		}
+	}
+}
+
+// Origins along one axis of the tiles covering size voxels, step apart; the
+// last one is moved back to end at the border.
+static vector<int> tileOrigins(const int size,const int tile,const int step){
+	vector<int> origins(1, 0);
+	while (origins.back() + tile < size) {
+		origins.push_back(std::min(origins.back() + step, size - tile));
+	}
+	return origins;
+}
+
+// Blending weights along one axis of a tile, largest at the centre and
+// positive up to the border: a Gaussian with sigma 1/8 of the tile, or a
+// linear ramp.
+static vector<float> tileWeights(const int tile,const bool gaussian){
+	vector<float> weights(tile);
+	const float center = 0.5f * (tile - 1);
+	const float sigma = tile / 8.f;
+	for (int i = 0; i < tile; ++i) {
+		const float d = i - center;
+		weights[i] = gaussian ? std::exp(-d * d / (2 * sigma * sigma)) :
+				1 - std::abs(d) / (center + 1);
+	}
+	return weights;
+}
+
+Caffe_API::Caffe_API() : usegpu_(false), batchReplica_(NULL) {
 }
 
 Caffe_API::~Caffe_API() {
+	stopBatching();
 }
 
-void Caffe_API::readNetwork(const string& proto_file,const string& trained_file){
+void Caffe_API::readNetwork(const string& proto_file,const string& trained_file,int num_replicas){
 //	ReadNetParamsFromTextFileOrDie(proto_file, &paramText_);
 //	ReadNetParamsFromBinaryFileOrDie(trained_file, &paramBinary_);
+	CHECK_GE(num_replicas, 0);
+	resetNet();
 	net_.reset(new Net<float>(proto_file, TEST));
 	net_->CopyTrainedLayersFrom(trained_file);
 	vector<Blob<float>*> input_layer = net_->input_blobs();
 	inputShape_ = input_layer[0]->shape();
+	// Bring the weights to the device now: the replicas read them
+	// concurrently, and a first access would copy them.
+	const vector<shared_ptr<Blob<float> > >& params = net_->params();
+	for (int i = 0; i < params.size(); ++i) {
+		if(usegpu_)
+			params[i]->gpu_data();
+		else
+			params[i]->cpu_data();
+	}
+	for (int i = 0; i < num_replicas; ++i) {
+		shared_ptr<Net<float> > replica(new Net<float>(proto_file, TEST));
+		replica->ShareTrainedLayersWith(net_.get());
+		replicas_.push_back(replica);
+		freeReplicas_.push(replica.get());
+	}
+}
+
+void Caffe_API::resetNet(){
+	stopBatching();
+	// Wait for the replicas still running infer() or inferVolume().
+	for (int i = 0; i < replicas_.size(); ++i) {
+		freeReplicas_.pop();
+	}
+	replicas_.clear();
+	boundInputs_.clear();
+	boundOutputs_.clear();
+	net_.reset();
 }
 
 
 void Caffe_API::inputData(float* data,const string& blob_name){
-	vector<Blob<float>*> input_layer = net_->input_blobs();
-	float* layerdata = input_layer[0]->mutable_cpu_data();
-	for (int i = 0; i < input_layer[0]->count(); ++i) {
-		layerdata[i] = data[i];
+	Blob<float>* input_blob = net_->input_blobs()[0];
+	caffe_copy(input_blob->count(), data, input_blob->mutable_cpu_data());
+}
+
+void Caffe_API::bindInput(float* data,const string& blob_name){
+	shared_ptr<Blob<float> > input_blob = net_->blob_by_name(blob_name);
+	input_blob->set_cpu_data(data);
+	if (std::find(boundInputs_.begin(), boundInputs_.end(), input_blob.get()) == boundInputs_.end()) {
+		boundInputs_.push_back(input_blob.get());
+	}
+}
+
+void Caffe_API::bindOutput(float* data,const string& blob_name){
+	shared_ptr<Blob<float> > output_blob = net_->blob_by_name(blob_name);
+	output_blob->set_cpu_data(data);
+	if (std::find(boundOutputs_.begin(), boundOutputs_.end(), output_blob.get()) == boundOutputs_.end()) {
+		boundOutputs_.push_back(output_blob.get());
 	}
 }
 
@@ -65,13 +164,277 @@ void Caffe_API::inputData(float*** data,const string& blob_name,bool transpose){
 
 }
 
+void Caffe_API::inputVolume(const float* data,const int axes[3],const string& blob_name,const int* strides,int num_threads){
+	shared_ptr<Blob<float> > input_blob = net_->blob_by_name(blob_name);
+	CHECK_GE(input_blob->num_axes(), 3);
+	const int first_axis = input_blob->num_axes() - 3;
+	CHECK_EQ(input_blob->count(0, first_axis), 1) << "Blob holds more than one volume";
+	int shape[3], data_shape[3] = {0, 0, 0}, data_strides[3];
+	for (int i = 0; i < 3; ++i) {
+		shape[i] = input_blob->shape(first_axis + i);
+		CHECK(axes[i] >= 0 && axes[i] < 3 && !data_shape[axes[i]]) << "axes must be a permutation of {0, 1, 2}";
+		data_shape[axes[i]] = shape[i];
+	}
+	if (strides) {
+		std::copy(strides, strides + 3, data_strides);
+	} else {
+		data_strides[2] = 1;
+		data_strides[1] = data_shape[2];
+		data_strides[0] = data_shape[1] * data_shape[2];
+	}
+	// Strides of the blob axes in data and in the blob.
+	int src[3], dst[3] = {shape[1] * shape[2], shape[2], 1};
+	for (int i = 0; i < 3; ++i) {
+		src[i] = data_strides[axes[i]];
+	}
+	// Copy planes of W and whichever of D and H is denser in data, so that
+	// one side of every tile is read or written contiguously.
+	const int rows = (src[2] > std::min(src[0], src[1]) && src[0] < src[1]) ? 0 : 1;
+	const int outer = 1 - rows;
+	float* inputdata = input_blob->mutable_cpu_data();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads)
+#endif
+	for (int o = 0; o < shape[outer]; ++o) {
+		copyPlane(shape[rows], shape[2], data + o * src[outer], src[rows], src[2],
+				inputdata + o * dst[outer], dst[rows]);
+	}
+}
+
 void Caffe_API::outputData(vector<float>& data,const string& blob_name){
 	shared_ptr<Blob<float> > output_blob = net_->blob_by_name(blob_name);
 	const float* begin_i = output_blob->cpu_data();
 	const float* end_i = begin_i + output_blob->count();
-	data = vector<float>(begin_i,end_i);
+	data.assign(begin_i,end_i);
+}
+
+const float* Caffe_API::outputView(const string& blob_name,int* count){
+	shared_ptr<Blob<float> > output_blob = net_->blob_by_name(blob_name);
+	if (count) {
+		*count = output_blob->count();
+	}
+	return output_blob->cpu_data();
 }
 
 void Caffe_API::run(){
+	// The caller may have rewritten the bound inputs since the last run: mark
+	// them as changed on the host, so that a GPU forward uploads them again.
+	for (int i = 0; i < boundInputs_.size(); ++i) {
+		boundInputs_[i]->mutable_cpu_data();
+	}
 	net_->Forward();
+	// Bring the outputs computed on the GPU back to the bound buffers.
+	for (int i = 0; i < boundOutputs_.size(); ++i) {
+		boundOutputs_[i]->cpu_data();
+	}
+}
+
+void Caffe_API::infer(const float* input,vector<float>& output){
+	// The mode is per thread; callers may come from threads that never set it.
+	Caffe::set_mode(usegpu_ ? Caffe::GPU : Caffe::CPU);
+	CHECK_GT(numReplicas(), batcher_ ? 1 : 0) << "infer() needs readNetwork with num_replicas >= 1, and one more while batching";
+	Net<float>* replica = freeReplicas_.pop();
+	Blob<float>* input_blob = replica->input_blobs()[0];
+	caffe_copy(input_blob->count(), input, input_blob->mutable_cpu_data());
+	replica->Forward();
+	const Blob<float>* output_blob = replica->output_blobs()[0];
+	const float* begin_i = output_blob->cpu_data();
+	output.assign(begin_i, begin_i + output_blob->count());
+	freeReplicas_.push(replica);
+}
+
+void Caffe_API::inferVolume(const float* volume,const int shape[3],const int tile[3],const int overlap[3],vector<float>& output,int batch_size,bool gaussian){
+	CHECK_GE(batch_size, 1);
+	Caffe::set_mode(usegpu_ ? Caffe::GPU : Caffe::CPU);
+	CHECK_GT(numReplicas(), batcher_ ? 1 : 0) << "inferVolume() needs readNetwork with num_replicas >= 1, and one more while batching";
+	Net<float>* replica = freeReplicas_.pop();
+	Blob<float>* input_blob = replica->input_blobs()[0];
+	CHECK_EQ(input_blob->num_axes(), 5) << "Expected an N x C x D x H x W input";
+	vector<int> input_shape(inputShape_);
+	input_shape[0] = batch_size;
+	std::copy(tile, tile + 3, input_shape.begin() + 2);
+	input_blob->Reshape(input_shape);
+	replica->Reshape();
+	const Blob<float>* output_blob = replica->output_blobs()[0];
+	CHECK_EQ(output_blob->num_axes(), 5) << "Expected an N x K x D x H x W output";
+	// The extents are short of the tile only for volumes smaller than it,
+	// which are padded with 0.
+	int extent[3];
+	vector<int> origins[3];
+	vector<float> weights[3];
+	for (int i = 0; i < 3; ++i) {
+		extent[i] = std::min(tile[i], shape[i]);
+		CHECK_EQ(output_blob->shape(2 + i), tile[i]) << "Tiles must keep their size through the net";
+		CHECK(overlap[i] >= 0 && overlap[i] < tile[i]) << "overlap must be smaller than the tile";
+		origins[i] = tileOrigins(shape[i], tile[i], tile[i] - overlap[i]);
+		weights[i] = tileWeights(tile[i], gaussian);
+	}
+	const int channels = input_blob->shape(1);
+	const int out_channels = output_blob->shape(1);
+	const int input_dim = input_blob->count(1);
+	const int output_dim = output_blob->count(1);
+	const int tile_dim = tile[0] * tile[1] * tile[2];
+	const int volume_dim = shape[0] * shape[1] * shape[2];
+	output.assign(out_channels * volume_dim, 0.f);
+	vector<float> norm(volume_dim, 0.f);
+	const int num_tiles = origins[0].size() * origins[1].size() * origins[2].size();
+	vector<int> batch_origins(3 * batch_size);
+	for (int t0 = 0; t0 < num_tiles; t0 += batch_size) {
+		// Gather the tiles straight into the input blob.
+		const int batch = std::min(batch_size, num_tiles - t0);
+		float* input_data = input_blob->mutable_cpu_data();
+		for (int b = 0; b < batch; ++b) {
+			int* o = &batch_origins[3 * b];
+			const int t = t0 + b;
+			o[0] = origins[0][t / (origins[1].size() * origins[2].size())];
+			o[1] = origins[1][t / origins[2].size() % origins[1].size()];
+			o[2] = origins[2][t % origins[2].size()];
+			float* tile_data = input_data + b * input_dim;
+			if (extent[0] * extent[1] * extent[2] < tile_dim) {
+				caffe_set(input_dim, 0.f, tile_data);
+			}
+			for (int c = 0; c < channels; ++c) {
+				for (int d = 0; d < extent[0]; ++d) {
+					for (int h = 0; h < extent[1]; ++h) {
+						caffe_copy(extent[2], volume + ((c * shape[0] + o[0] + d) * shape[1] + o[1] + h) * shape[2] + o[2],
+								tile_data + ((c * tile[0] + d) * tile[1] + h) * tile[2]);
+					}
+				}
+			}
+		}
+		replica->Forward();
+		// Blend the outputs in place from the output blob.
+		const float* output_data = output_blob->cpu_data();
+		for (int b = 0; b < batch; ++b) {
+			const int* o = &batch_origins[3 * b];
+			for (int d = 0; d < extent[0]; ++d) {
+				for (int h = 0; h < extent[1]; ++h) {
+					const float w_dh = weights[0][d] * weights[1][h];
+					const int offset = ((o[0] + d) * shape[1] + o[1] + h) * shape[2] + o[2];
+					const int tile_offset = (d * tile[1] + h) * tile[2];
+					for (int w = 0; w < extent[2]; ++w) {
+						norm[offset + w] += w_dh * weights[2][w];
+					}
+					for (int k = 0; k < out_channels; ++k) {
+						const float* tile_out = output_data + b * output_dim + k * tile_dim + tile_offset;
+						float* out = &output[k * volume_dim + offset];
+						for (int w = 0; w < extent[2]; ++w) {
+							out[w] += w_dh * weights[2][w] * tile_out[w];
+						}
+					}
+				}
+			}
+		}
+	}
+	for (int k = 0; k < out_channels; ++k) {
+		float* out = &output[k * volume_dim];
+		for (int i = 0; i < volume_dim; ++i) {
+			out[i] /= norm[i];
+		}
+	}
+	// Back to the shape infer() expects.
+	input_blob->Reshape(inputShape_);
+	replica->Reshape();
+	freeReplicas_.push(replica);
+}
+
+void Caffe_API::startBatching(int max_batch,int max_wait_us){
+	CHECK(!batcher_) << "Batching already started";
+	Caffe::set_mode(usegpu_ ? Caffe::GPU : Caffe::CPU);
+	CHECK(!replicas_.empty()) << "Batching needs readNetwork with num_replicas >= 1";
+	// Keep infer() off the replica the batcher runs.
+	batchReplica_ = freeReplicas_.pop();
+	batcher_.reset(new Caffe_API_Batcher(batchReplica_, max_batch, max_wait_us));
+}
+
+boost::shared_future<vector<float> > Caffe_API::submit(const float* input){
+	CHECK(batcher_) << "Call startBatching() before submit()";
+	return batcher_->submit(input);
+}
+
+void Caffe_API::stopBatching(){
+	if (batcher_) {
+		batcher_.reset();
+		// Back to the batch size infer() expects.
+		batchReplica_->input_blobs()[0]->Reshape(inputShape_);
+		batchReplica_->Reshape();
+		freeReplicas_.push(batchReplica_);
+		batchReplica_ = NULL;
+	}
+}
+
+Caffe_API_Batcher::Caffe_API_Batcher(Net<float>* net,int max_batch,int max_wait_us)
+	: net_(net), maxBatch_(max_batch), maxWaitUs_(max_wait_us) {
+	CHECK_GE(max_batch, 1);
+	CHECK_GE(max_wait_us, 0);
+	StartInternalThread();
+}
+
+Caffe_API_Batcher::~Caffe_API_Batcher() {
+	// Requests still queued see a broken promise.
+	StopInternalThread();
+}
+
+boost::shared_future<vector<float> > Caffe_API_Batcher::submit(const float* input){
+	shared_ptr<Request> request(new Request());
+	request->input = input;
+	request->enqueued = boost::get_system_time();
+	boost::shared_future<vector<float> > output(request->output.get_future());
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		requests_.push_back(request);
+	}
+	condition_.notify_one();
+	return output;
+}
+
+void Caffe_API_Batcher::InternalThreadEntry(){
+	try {
+		while (!must_stop()) {
+			vector<shared_ptr<Request> > batch;
+			{
+				boost::mutex::scoped_lock lock(mutex_);
+				while (requests_.empty()) {
+					condition_.wait(lock);
+				}
+				// Give the batch until max_wait_us after its oldest request,
+				// which may have been queued while the last batch ran.
+				const boost::system_time deadline = requests_.front()->enqueued +
+						boost::posix_time::microseconds(maxWaitUs_);
+				while (requests_.size() < maxBatch_ &&
+						condition_.timed_wait(lock, deadline)) {
+				}
+				while (!requests_.empty() && batch.size() < maxBatch_) {
+					batch.push_back(requests_.front());
+					requests_.pop_front();
+				}
+			}
+			runBatch(batch);
+		}
+	} catch (boost::thread_interrupted&) {
+		// Interrupted exception is expected on shutdown
+	}
+}
+
+void Caffe_API_Batcher::runBatch(const vector<shared_ptr<Request> >& batch){
+	Blob<float>* input_blob = net_->input_blobs()[0];
+	if (input_blob->shape(0) != batch.size()) {
+		vector<int> shape = input_blob->shape();
+		shape[0] = batch.size();
+		input_blob->Reshape(shape);
+		net_->Reshape();
+	}
+	const int input_dim = input_blob->count(1);
+	float* input_data = input_blob->mutable_cpu_data();
+	for (int i = 0; i < batch.size(); ++i) {
+		caffe_copy(input_dim, batch[i]->input, input_data + i * input_dim);
+	}
+	net_->Forward();
+	const Blob<float>* output_blob = net_->output_blobs()[0];
+	const int output_dim = output_blob->count(1);
+	const float* output_data = output_blob->cpu_data();
+	for (int i = 0; i < batch.size(); ++i) {
+		const float* begin_i = output_data + i * output_dim;
+		batch[i]->output.set_value(vector<float>(begin_i, begin_i + output_dim));
+	}
 }
@@ -9,6 +9,11 @@
 #define CAFFE_API_CAFFEAPI_H_
 
 #include <caffe\caffe.hpp>
+#include <caffe\internal_thread.hpp>
+#include <caffe\util\blocking_queue.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/future.hpp>
+#include <deque>
 #include <string>
 #include <vector>
 #include <memory>
@@ -17,27 +22,107 @@ using namespace caffe;
 using std::string;
 using std::vector;
 
+// Runs the requests submitted from any thread through one net, a batch at a
+// time: it waits for up to max_batch requests, but no longer than max_wait_us
+// after the first, then resizes the batch dimension of the input blob and runs
+// a single Forward for all of them.
+class Caffe_API_Batcher : public InternalThread {
+public:
+	Caffe_API_Batcher(Net<float>* net,int max_batch,int max_wait_us);
+	virtual ~Caffe_API_Batcher();
+	// input holds one item of the first input blob and must stay valid until
+	// the future, one item of the first output blob, is ready.
+	boost::shared_future<vector<float> > submit(const float* input);
+protected:
+	struct Request {
+		const float* input;
+		boost::promise<vector<float> > output;
+		boost::system_time enqueued;
+	};
+	virtual void InternalThreadEntry();
+	void runBatch(const vector<shared_ptr<Request> >& batch);
+
+	Net<float>* net_;
+	int maxBatch_;
+	int maxWaitUs_;
+	std::deque<shared_ptr<Request> > requests_;
+	boost::mutex mutex_;
+	boost::condition_variable condition_;
+};
+
 class Caffe_API {
 public:
 	Caffe_API();
 	void setMode(bool usegpu){
+		usegpu_ = usegpu;
 		if(usegpu)
 			Caffe::set_mode(Caffe::GPU);
 		else
 			Caffe::set_mode(Caffe::CPU);
 	}
-	void readNetwork(const string& proto_file,const string& trained_file);
-	void resetNet(){net_.reset();}
+	// The net read serves the single-threaded calls (inputData, bind*, run,
+	// outputData...). num_replicas more nets share its trained weights and
+	// serve infer(), inferVolume() and submit(), so that up to num_replicas
+	// threads can run at once without touching the first net or its inputs.
+	void readNetwork(const string& proto_file,const string& trained_file,int num_replicas = 0);
+	// Waits for the infer() and inferVolume() calls in flight to return the
+	// replicas before freeing them; no new call may start meanwhile.
+	void resetNet();
 	void inputData(float *data,const string& blob_name);
 	void inputData(float ***data,const string& blob_name,bool transpose = false);
+	// Copies a contiguous volume into the last three (D, H, W) axes of a blob
+	// holding a single volume. Blob axis i is axis axes[i] of data, so
+	// {0, 1, 2} is a plain copy and {2, 1, 0} a transpose; strides gives the
+	// element strides of the data axes (default: dense). The copy is cache
+	// blocked and split over num_threads OpenMP threads.
+	void inputVolume(const float* data,const int axes[3],const string& blob_name,const int* strides = NULL,int num_threads = 1);
 	void outputData(vector<float>& data,const string& blob_name);
+	// Zero-copy binding of a caller-owned buffer of blob count floats, which
+	// run() then reads the input from or writes the output to (in GPU mode,
+	// run() uploads the input from it and downloads the output to it). The
+	// binding holds until the net is reset or the blob grows past its current
+	// size. Only the net of run() is bound: infer(), inferVolume() and
+	// submit() run on the replicas and ignore the bindings.
+	void bindInput(float* data,const string& blob_name);
+	void bindOutput(float* data,const string& blob_name);
+	// Read-only view of an output blob, valid until the next run().
+	const float* outputView(const string& blob_name,int* count = NULL);
 	void readTestDataFromBinFile(const char* datafile,const string& blob_name);
 	void run();
+	// Thread-safe: copies input into the first input blob of a free replica
+	// (waiting while all are busy), runs it and returns its first output blob.
+	// Needs num_replicas >= 1.
+	void infer(const float* input,vector<float>& output);
+	int numReplicas() const {return replicas_.size();}
+	// Sliding-window inference over a dense C x D x H x W volume of any
+	// D x H x W (shape), on a free replica whose input is reshaped once to
+	// batch_size tiles of tile[0] x tile[1] x tile[2]. Neighbouring tiles
+	// overlap by overlap[i] voxels and their outputs are blended with Gaussian
+	// (or linear) weights falling off from the tile centre. output receives
+	// the K x D x H x W blend of the first output blob, which must keep the
+	// tile size. The replica gets its infer() shape back afterwards; the net
+	// of run() is never reshaped, so its bindings hold.
+	void inferVolume(const float* volume,const int shape[3],const int tile[3],const int overlap[3],vector<float>& output,int batch_size = 1,bool gaussian = true);
+	// Asynchronous inference through a Caffe_API_Batcher running on one of
+	// the replicas; see there for submit(). infer() and inferVolume() then
+	// need one more replica.
+	void startBatching(int max_batch,int max_wait_us);
+	boost::shared_future<vector<float> > submit(const float* input);
+	void stopBatching();
 	virtual ~Caffe_API();
 protected:
 	shared_ptr<Net<float> > net_;
 	//NetParameter paramText_,paramBinary_;
 	vector<int> inputShape_;
+	bool usegpu_;
+	// The blobs of net_ bound to caller buffers.
+	vector<Blob<float>*> boundInputs_, boundOutputs_;
+	// The replicas sharing the weights of net_; the idle ones wait in
+	// freeReplicas_. net_ is never among them.
+	vector<shared_ptr<Net<float> > > replicas_;
+	BlockingQueue<Net<float>*> freeReplicas_;
+	shared_ptr<Caffe_API_Batcher> batcher_;
+	Net<float>* batchReplica_;
 };
 
 #endif /* CAFFE_API_CAFFEAPI_H_ */
@@ -170,6 +170,15 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   }
 }
 
+template <typename Dtype>
+void Blob<Dtype>::ShareDataMemory(const shared_ptr<SyncedMemory>& memory) {
+  const int memory_count = memory->size() / sizeof(Dtype);
+  CHECK_GE(memory_count, count_);
+  data_ = memory;
+  // Reshape must reallocate rather than grow past the shared buffer.
+  capacity_ = std::min(capacity_, memory_count);
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
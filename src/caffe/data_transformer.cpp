@@ -2,6 +2,7 @@
 #include <opencv2/core/core.hpp>
 #endif  // USE_OPENCV
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -38,11 +39,45 @@ DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
   }
 }
 
+// Transforms one row of width elements: dst[w] = (src[w] - mean) * scale,
+// mean being mean_row[w] if given and mean_value otherwise, stored at
+// dst[width - 1 - w] when mirroring. Each case is a plain loop the compiler
+// can vectorize, and computes exactly what the per-element expression does.
+template <typename Stype, typename Dtype>
+static void transform_row(const int width, const Stype* src,
+    const Dtype* mean_row, const Dtype mean_value, const Dtype scale,
+    const bool mirror, Dtype* dst) {
+  if (mirror) {
+    Dtype* dst_end = dst + width - 1;
+    if (mean_row) {
+      for (int w = 0; w < width; ++w) {
+        dst_end[-w] = (static_cast<Dtype>(src[w]) - mean_row[w]) * scale;
+      }
+    } else {
+      for (int w = 0; w < width; ++w) {
+        dst_end[-w] = (static_cast<Dtype>(src[w]) - mean_value) * scale;
+      }
+    }
+  } else if (mean_row) {
+    for (int w = 0; w < width; ++w) {
+      dst[w] = (static_cast<Dtype>(src[w]) - mean_row[w]) * scale;
+    }
+  } else if (mean_value == Dtype(0) && scale == Dtype(1)) {
+    // (x - 0) * 1 == x: a plain (for float data, memcpy) copy.
+    std::copy(src, src + width, dst);
+  } else {
+    for (int w = 0; w < width; ++w) {
+      dst[w] = (static_cast<Dtype>(src[w]) - mean_value) * scale;
+    }
+  }
+}
+
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const Datum& datum,
                                        Dtype* transformed_data) {
   const string& data = datum.data();
   const int datum_channels = datum.channels();
+  const int datum_depth = datum.depth();
   const int datum_height = datum.height();
   const int datum_width = datum.width();
 
@@ -54,14 +89,20 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
   const bool has_mean_values = mean_values_.size() > 0;
 
   CHECK_GT(datum_channels, 0);
+  CHECK_GT(datum_depth, 0);
   CHECK_GE(datum_height, crop_size);
   CHECK_GE(datum_width, crop_size);
 
   Dtype* mean = NULL;
   if (has_mean_file) {
-    CHECK_EQ(datum_channels, data_mean_.channels());
-    CHECK_EQ(datum_height, data_mean_.height());
-    CHECK_EQ(datum_width, data_mean_.width());
+    if (datum_depth == 1) {
+      CHECK_EQ(datum_channels, data_mean_.channels());
+      CHECK_EQ(datum_height, data_mean_.height());
+      CHECK_EQ(datum_width, data_mean_.width());
+    } else {
+      CHECK_EQ(datum_channels * datum_depth * datum_height * datum_width,
+          data_mean_.count());
+    }
     mean = data_mean_.mutable_cpu_data();
   }
   if (has_mean_values) {
@@ -75,9 +116,11 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
     }
   }
 
+  int depth = datum_depth;
   int height = datum_height;
   int width = datum_width;
 
+  int d_off = 0;
   int h_off = 0;
   int w_off = 0;
   if (crop_size) {
@@ -91,35 +134,34 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
       h_off = (datum_height - crop_size) / 2;
       w_off = (datum_width - crop_size) / 2;
     }
+    if (datum_depth > 1) {
+      CHECK_GE(datum_depth, crop_size);
+      depth = crop_size;
+      if (phase_ == TRAIN) {
+        d_off = Rand(datum_depth - crop_size + 1);
+      } else {
+        d_off = (datum_depth - crop_size) / 2;
+      }
+    }
   }
 
-  Dtype datum_element;
-  int top_index, data_index;
+  const uint8_t* uint8_data = reinterpret_cast<const uint8_t*>(data.data());
+  const float* float_data = datum.float_data().data();
   for (int c = 0; c < datum_channels; ++c) {
-    for (int h = 0; h < height; ++h) {
-      for (int w = 0; w < width; ++w) {
-        data_index = (c * datum_height + h_off + h) * datum_width + w_off + w;
-        if (do_mirror) {
-          top_index = (c * height + h) * width + (width - 1 - w);
-        } else {
-          top_index = (c * height + h) * width + w;
-        }
+    const Dtype mean_value = has_mean_values ? mean_values_[c] : Dtype(0);
+    for (int d = 0; d < depth; ++d) {
+      for (int h = 0; h < height; ++h) {
+        const int data_index = ((c * datum_depth + d_off + d) * datum_height
+            + h_off + h) * datum_width + w_off;
+        Dtype* top_row = transformed_data + ((c * depth + d) * height + h)
+            * width;
+        const Dtype* mean_row = has_mean_file ? mean + data_index : NULL;
         if (has_uint8) {
-          datum_element =
-            static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-        } else {
-          datum_element = datum.float_data(data_index);
-        }
-        if (has_mean_file) {
-          transformed_data[top_index] =
-            (datum_element - mean[data_index]) * scale;
+          transform_row(width, uint8_data + data_index, mean_row, mean_value,
+              scale, do_mirror, top_row);
         } else {
-          if (has_mean_values) {
-            transformed_data[top_index] =
-              (datum_element - mean_values_[c]) * scale;
-          } else {
-            transformed_data[top_index] = datum_element * scale;
-          }
+          transform_row(width, float_data + data_index, mean_row, mean_value,
+              scale, do_mirror, top_row);
         }
       }
     }
@@ -158,6 +200,19 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
   const int datum_height = datum.height();
   const int datum_width = datum.width();
 
+  if (datum.depth() > 1) {
+    // Check dimensions of volumetric data.
+    const int datum_depth = datum.depth();
+    CHECK_EQ(transformed_blob->num_axes(), 5);
+    CHECK_GE(transformed_blob->shape(0), 1);
+    CHECK_EQ(transformed_blob->shape(1), datum_channels);
+    CHECK_EQ(transformed_blob->shape(2), crop_size ? crop_size : datum_depth);
+    CHECK_EQ(transformed_blob->shape(3), crop_size ? crop_size : datum_height);
+    CHECK_EQ(transformed_blob->shape(4), crop_size ? crop_size : datum_width);
+    Transform(datum, transformed_blob->mutable_cpu_data());
+    return;
+  }
+
   // Check dimensions.
   const int channels = transformed_blob->channels();
   const int height = transformed_blob->height();
@@ -185,15 +240,14 @@ template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const vector<Datum> & datum_vector,
                                        Blob<Dtype>* transformed_blob) {
   const int datum_num = datum_vector.size();
-  const int num = transformed_blob->num();
-  const int channels = transformed_blob->channels();
-  const int height = transformed_blob->height();
-  const int width = transformed_blob->width();
+  const int num = transformed_blob->shape(0);
 
   CHECK_GT(datum_num, 0) << "There is no datum to add";
   CHECK_LE(datum_num, num) <<
     "The size of datum_vector must be no greater than transformed_blob->num()";
-  Blob<Dtype> uni_blob(1, channels, height, width);
+  vector<int> item_shape = transformed_blob->shape();
+  item_shape[0] = 1;
+  Blob<Dtype> uni_blob(item_shape);
   for (int item_id = 0; item_id < datum_num; ++item_id) {
     int offset = transformed_blob->offset(item_id);
     uni_blob.set_cpu_data(transformed_blob->mutable_cpu_data() + offset);
@@ -471,6 +525,10 @@ vector<int> DataTransformer<Dtype>::InferBlobShape(const Datum& datum) {
   shape[1] = datum_channels;
   shape[2] = (crop_size)? crop_size: datum_height;
   shape[3] = (crop_size)? crop_size: datum_width;
+  if (datum.depth() > 1) {
+    CHECK_GE(datum.depth(), crop_size);
+    shape.insert(shape.begin() + 2, (crop_size)? crop_size: datum.depth());
+  }
   return shape;
 }
 
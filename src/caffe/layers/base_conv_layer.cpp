@@ -14,6 +14,12 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // Configure the kernel size, padding, stride, and inputs.
   ConvolutionParameter conv_param = this->layer_param_.convolution_param();
   force_nd_im2col_ = conv_param.force_nd_im2col();
+  shared_workspace_ = conv_param.shared_workspace();
+  fused_relu_ = conv_param.fused_relu();
+  CHECK(!fused_relu_ || this->phase_ == TEST)
+      << "fused_relu is for inference only (it has no backward).";
+  CHECK(!fused_relu_ || !reverse_dimensions())
+      << "fused_relu is only implemented for Convolution.";
   channel_axis_ = bottom[0]->CanonicalAxisIndex(conv_param.axis());
   const int first_spatial_axis = channel_axis_ + 1;
   const int num_axes = bottom[0]->num_axes();
@@ -131,6 +137,11 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   CHECK_EQ(channels_ % group_, 0);
   CHECK_EQ(num_output_ % group_, 0)
       << "Number of output should be multiples of group.";
+  if (conv_param.partial_conv_tile_size() > 0) {
+    CHECK(partial_conv_lower_)
+        << "partial_conv_tile_size requires partial_conv_lower.";
+    CHECK_EQ(group_, 1) << "partial_conv_tile_size requires group == 1.";
+  }
   if (reverse_dimensions()) {
     conv_out_channels_ = channels_;
     conv_in_channels_ = num_output_;
@@ -257,10 +268,66 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       col_buffer_shape_.push_back(output_shape_[i]);
     }
   }
+  // Split the outermost spatial axis into slabs so that the partial column
+  // buffer holds at most partial_conv_tile_size output positions.
+  conv_out_outer_dim_ = (num_spatial_axes_ > 0) ? col_buffer_shape_[1] : 1;
+  conv_out_inner_dim_ = (conv_out_outer_dim_ > 0) ?
+      conv_out_spatial_dim_ / conv_out_outer_dim_ : 0;
+  partial_tile_rows_ = conv_out_outer_dim_;
+  const int tile_size =
+      this->layer_param_.convolution_param().partial_conv_tile_size();
+  if (partial_conv_lower_ && tile_size > 0 && !is_1x1_ &&
+      conv_out_inner_dim_ > 0) {
+    partial_tile_rows_ = std::min(conv_out_outer_dim_,
+        std::max(1, tile_size / conv_out_inner_dim_));
+    col_buffer_shape_[1] = partial_tile_rows_;
+  }
   col_buffer_.Reshape(col_buffer_shape_);
+  borrow_workspace(Workspace::COLUMN, &col_buffer_);
 
   bottom_dim_ = bottom[0]->count(channel_axis_);
   top_dim_ = top[0]->count(channel_axis_);
+  // Lower as many images per GEMM as fit in gemm_batch_memory. The batched
+  // buffers are only touched (and so allocated) by the CPU path.
+  gemm_batch_ = 1;
+  const uint64_t gemm_batch_memory =
+      this->layer_param_.convolution_param().gemm_batch_memory();
+  if (gemm_batch_memory > 0 && !partial_conv_lower_ && !reverse_dimensions() &&
+      conv_out_spatial_dim_ > 0) {
+    const uint64_t image_bytes = static_cast<uint64_t>(sizeof(Dtype)) *
+        (kernel_dim_ * group_ + conv_out_channels_) * conv_out_spatial_dim_;
+    gemm_batch_ = static_cast<int>(std::min<uint64_t>(num_,
+        std::max<uint64_t>(1, gemm_batch_memory / image_bytes)));
+  }
+  if (gemm_batch_ > 1) {
+    vector<int> batch_buffer_shape(2);
+    batch_buffer_shape[0] = kernel_dim_ * group_;
+    batch_buffer_shape[1] = gemm_batch_ * conv_out_spatial_dim_;
+    batch_col_buffer_.Reshape(batch_buffer_shape);
+    batch_buffer_shape[0] = conv_out_channels_;
+    batch_output_buffer_.Reshape(batch_buffer_shape);
+    borrow_workspace(Workspace::BATCH_COLUMN, &batch_col_buffer_);
+    borrow_workspace(Workspace::BATCH_OUTPUT, &batch_output_buffer_);
+  }
+  // Spread the images of the batch over OpenMP threads, each with its own
+  // column buffer. The partial path and the batched GEMM share state across
+  // images and stay serial.
+  cpu_threads_ = 1;
+#ifdef _OPENMP
+  if (!partial_conv_lower_ && gemm_batch_ == 1) {
+    const int cpu_threads = this->layer_param_.convolution_param().cpu_threads();
+    cpu_threads_ = std::max(1, std::min(num_,
+        cpu_threads > 0 ? cpu_threads : omp_get_max_threads()));
+  }
+#endif
+  if (cpu_threads_ > 1) {
+    vector<int> thread_buffer_shape(1, cpu_threads_);
+    thread_buffer_shape.push_back(is_1x1_ ? 0 : col_buffer_.count());
+    thread_col_buffer_.Reshape(thread_buffer_shape);
+    borrow_workspace(Workspace::THREAD_COLUMN, &thread_col_buffer_);
+    thread_buffer_shape[1] = this->blobs_[0]->count();
+    thread_weight_diff_.Reshape(thread_buffer_shape);
+  }
   num_kernels_im2col_ = conv_in_channels_ * conv_out_spatial_dim_;        //only used with gpu
   num_kernels_col2im_ = reverse_dimensions() ? top_dim_ : bottom_dim_;    //only used with gpu
   if(partial_conv_lower_) {
@@ -277,24 +344,135 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
-template <typename Dtype> 
-void BaseConvolutionLayer<Dtype>::get_col_from_row_major_matrix(const Dtype* matrix, Dtype* col_result, int len_row, int num_rows, int len_col, int col_number) {
-  int index = 0;
-  for (int row = 0; row < num_rows; ++row) {
-    for (int col_pos = 0; col_pos < len_col; ++col_pos) {
-      col_result[index++] = matrix[row * len_row + (col_pos + col_number * len_col)];
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::borrow_workspace(const Workspace::Slot slot,
+    Blob<Dtype>* buffer) {
+  if (shared_workspace_) {
+    buffer->ShareDataMemory(
+        Workspace::Get(slot, buffer->count() * sizeof(Dtype)));
+  }
+}
+
+// Copy a [rows, dim] matrix between buffers with different row strides; used
+// to place each image of a batch in its own columns of the batched matrices.
+template <typename Dtype>
+static void copy_rows_cpu(const int rows, const int dim, const Dtype* src,
+    const int src_stride, Dtype* dst, const int dst_stride) {
+  for (int r = 0; r < rows; ++r) {
+    caffe_copy(dim, src + r * src_stride, dst + r * dst_stride);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::conv_im2col_batch_cpu(const Dtype* data,
+    const int batch, Dtype* batch_col_buff) {
+  const int batch_dim = batch * conv_out_spatial_dim_;
+  for (int b = 0; b < batch; ++b) {
+    const Dtype* col_buff = data + b * bottom_dim_;
+    if (!is_1x1_) {
+      conv_im2col_cpu(col_buff, col_buffer_.mutable_cpu_data());
+      col_buff = col_buffer_.cpu_data();
+    }
+    copy_rows_cpu(kernel_dim_ * group_, conv_out_spatial_dim_, col_buff,
+        conv_out_spatial_dim_, batch_col_buff + b * conv_out_spatial_dim_,
+        batch_dim);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::conv_col2im_batch_cpu(
+    const Dtype* batch_col_buff, const int batch, Dtype* data) {
+  const int batch_dim = batch * conv_out_spatial_dim_;
+  for (int b = 0; b < batch; ++b) {
+    Dtype* col_buff = is_1x1_ ? data + b * bottom_dim_ :
+        col_buffer_.mutable_cpu_data();
+    copy_rows_cpu(kernel_dim_ * group_, conv_out_spatial_dim_,
+        batch_col_buff + b * conv_out_spatial_dim_, batch_dim, col_buff,
+        conv_out_spatial_dim_);
+    if (!is_1x1_) {
+      conv_col2im_cpu(col_buff, data + b * bottom_dim_);
     }
   }
 }
 
 template <typename Dtype>
-void BaseConvolutionLayer<Dtype>::add_col_to_row_major_matrix(Dtype* matrix, Dtype* add_col, int len_row, int num_rows, int len_col, int col_number) {
-  int index = 0;
-  for (int row = 0; row < num_rows; ++row) {
-    for (int col_pos = 0; col_pos < len_col; ++col_pos) {
-      matrix[row * len_row + (col_pos + col_number * len_col)] += add_col[index++];
+const vector<Dtype*>& BaseConvolutionLayer<Dtype>::thread_col_buffers() {
+  thread_col_buffers_.assign(cpu_threads_, NULL);
+  if (!is_1x1_) {
+    Dtype* col_data = thread_col_buffer_.mutable_cpu_data();
+    for (int t = 0; t < cpu_threads_; ++t) {
+      thread_col_buffers_[t] = col_data + t * col_buffer_.count();
     }
-  }  
+  }
+  return thread_col_buffers_;
+}
+
+template <typename Dtype>
+Dtype* BaseConvolutionLayer<Dtype>::thread_weight_diffs() {
+  caffe_set(thread_weight_diff_.count(), Dtype(0),
+      thread_weight_diff_.mutable_cpu_data());
+  return thread_weight_diff_.mutable_cpu_data();
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::reduce_thread_weight_diffs(
+    const Dtype* thread_diffs, Dtype* weight_diff) {
+  const int count = this->blobs_[0]->count();
+  for (int t = 0; t < cpu_threads_; ++t) {
+    caffe_axpy(count, Dtype(1), thread_diffs + t * count, weight_diff);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::conv_im2col_tile_cpu(const Dtype* data,
+    const int tile_start, const int tile_rows, Dtype* col_buff) {
+  if (tile_rows == conv_out_outer_dim_) {
+    conv_im2col_cpu(data, col_buff);
+    return;
+  }
+  // Lower only the requested slab: shrink the first column axis and shift the
+  // padding so that the slab's first row maps to output row tile_start.
+  int tile_col_shape[kMaxBlobAxes + 1];
+  int tile_pad[kMaxBlobAxes];
+  const int* pad_data = pad_.cpu_data();
+  const int* stride_data = stride_.cpu_data();
+  for (int i = 0; i <= num_spatial_axes_; ++i) {
+    tile_col_shape[i] = col_buffer_shape_[i];
+  }
+  tile_col_shape[1] = tile_rows;
+  for (int i = 0; i < num_spatial_axes_; ++i) {
+    tile_pad[i] = pad_data[i];
+  }
+  tile_pad[0] -= tile_start * stride_data[0];
+  im2col_nd_cpu(data, num_spatial_axes_, conv_input_shape_.cpu_data(),
+      tile_col_shape, kernel_shape_.cpu_data(), tile_pad, stride_data,
+      dilation_.cpu_data(), col_buff);
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::conv_col2im_tile_cpu(const Dtype* col_buff,
+    const int tile_start, const int tile_rows, Dtype* data) {
+  if (tile_rows == conv_out_outer_dim_) {
+    conv_col2im_cpu(col_buff, data);
+    return;
+  }
+  // Slabs overlap in the image whenever the kernel extent exceeds the stride,
+  // so accumulate; the caller clears the image before the first slab.
+  int tile_col_shape[kMaxBlobAxes + 1];
+  int tile_pad[kMaxBlobAxes];
+  const int* pad_data = pad_.cpu_data();
+  const int* stride_data = stride_.cpu_data();
+  for (int i = 0; i <= num_spatial_axes_; ++i) {
+    tile_col_shape[i] = col_buffer_shape_[i];
+  }
+  tile_col_shape[1] = tile_rows;
+  for (int i = 0; i < num_spatial_axes_; ++i) {
+    tile_pad[i] = pad_data[i];
+  }
+  tile_pad[0] -= tile_start * stride_data[0];
+  col2im_nd_add_cpu(col_buff, num_spatial_axes_, conv_input_shape_.cpu_data(),
+      tile_col_shape, kernel_shape_.cpu_data(), tile_pad, stride_data,
+      dilation_.cpu_data(), data);
 }
 
 template <typename Dtype> 
@@ -303,49 +481,56 @@ void BaseConvolutionLayer<Dtype>::partial_forward_cpu_gemm(const Dtype* input, c
   int input_channel_offset = reverse_dimensions() ? top_dim_ / conv_in_channels_ : bottom_dim_ / conv_in_channels_;
   int weights_per_col = kernel_dim_ / conv_in_channels_;
   Dtype gemm_beta = 0.;
-  Dtype* channel_weights (new Dtype[conv_out_channels_ * weights_per_col]);
 
   // weight data is organized into <conv_in_channels> total columns, each of which is <conv_out_channels>
-  // tall.  This 2d matrix is flattened out and stored in the weights matrix.
-  // the weights channel matrix will iterate through 0 -
+  // tall.  A channel's column is read in place by giving the gemm the full row length as lda.
   int input_channels = conv_in_channels_;
   for (int channel_num = 0; channel_num < input_channels; ++channel_num) {
-    get_col_from_row_major_matrix(weights, channel_weights, kernel_dim_, conv_out_channels_, weights_per_col, channel_num);
-    
-    if (!is_1x1_) {
-      conv_in_channels_ = 1;    //this variable is used when im2col_cpu is called by conv_im2col_cpu for 2d convolution
-      conv_im2col_cpu(input + channel_num * input_channel_offset, col_buffer_.mutable_cpu_data());
-      conv_in_channels_ = input_channels;
-      col_buff = col_buffer_.cpu_data();
-    } 
-    else {
-      col_buff = input + channel_num * input_channel_offset;
-    } 
-    for (int g = 0; g < group_; ++g) {
-      caffe_cpu_gemm<Dtype>(CblasNoTrans,                         // CBLAS_TRANSPOSE TransA
-                            CblasNoTrans,                         // CBLAS_TRANSPOSE TransB
-                            conv_out_channels_ / group_,          // M  (# A and C rows)
-                            conv_out_spatial_dim_,                // N  (# B and C columns)
-                            kernel_dim_ / conv_in_channels_,      // K  (# A columns, # B rows)       
-                            (Dtype)1.,                            // alpha
-                            channel_weights + weight_offset_ * g, // A : m rows by k columns
-                            col_buff + col_offset_ * g,           // B : k rows by n columns  
-                            gemm_beta,                            // beta
-                            output + output_offset_ * g);         // C : m rows by n columns = alpha * A * B + beta * C
+    const Dtype* channel_weights = weights + channel_num * weights_per_col;
+    // lower and multiply one slab of output rows at a time (a single slab unless tiling is enabled)
+    for (int tile_start = 0; tile_start < conv_out_outer_dim_; tile_start += partial_tile_rows_) {
+      const int tile_rows = std::min(partial_tile_rows_, conv_out_outer_dim_ - tile_start);
+      const int tile_dim = tile_rows * conv_out_inner_dim_;
+      if (!is_1x1_) {
+        conv_in_channels_ = 1;    //this variable is used when im2col_cpu is called by conv_im2col_cpu for 2d convolution
+        conv_im2col_tile_cpu(input + channel_num * input_channel_offset, tile_start, tile_rows, col_buffer_.mutable_cpu_data());
+        conv_in_channels_ = input_channels;
+        col_buff = col_buffer_.cpu_data();
+      } 
+      else {
+        col_buff = input + channel_num * input_channel_offset;
+      } 
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans,                         // CBLAS_TRANSPOSE TransA
+                              CblasNoTrans,                         // CBLAS_TRANSPOSE TransB
+                              conv_out_channels_ / group_,          // M  (# A and C rows)
+                              tile_dim,                             // N  (# B and C columns)
+                              weights_per_col,                      // K  (# A columns, # B rows)
+                              (Dtype)1.,                            // alpha
+                              channel_weights + weight_offset_ * g, // A : m rows by k columns
+                              kernel_dim_,                          // lda
+                              col_buff + col_offset_ * g,           // B : k rows by n columns
+                              tile_dim,                             // ldb
+                              gemm_beta,                            // beta
+                              output + output_offset_ * g + tile_start * conv_out_inner_dim_,  // C : m rows by n columns = alpha * A * B + beta * C
+                              conv_out_spatial_dim_);               // ldc
+      }
     }
     if(channel_num == 0) gemm_beta = 1.;
   }    
-  delete[] channel_weights;
 }
 
 template <typename Dtype> 
-void BaseConvolutionLayer<Dtype>::full_forward_cpu_gemm(const Dtype* input, const Dtype* weights, Dtype* output, bool skip_im2col) {
+void BaseConvolutionLayer<Dtype>::full_forward_cpu_gemm(const Dtype* input, const Dtype* weights, Dtype* output, bool skip_im2col, Dtype* col_data) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
+    if (!col_data) {
+      col_data = col_buffer_.mutable_cpu_data();
+    }
     if (!skip_im2col) {
-      conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+      conv_im2col_cpu(input, col_data);
     }
-    col_buff = col_buffer_.cpu_data();
+    col_buff = col_data;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ / group_, 
@@ -363,40 +548,56 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
       (Dtype)1., output);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_relu(Dtype* output) {
+  for (int i = 0; i < top_dim_; ++i) {
+    output[i] = std::max(output[i], Dtype(0));
+  }
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::partial_backward_cpu_gemm(const Dtype* output, const Dtype* weights, Dtype* input) {
   Dtype* col_buff = (is_1x1_) ? input : col_buffer_.mutable_cpu_data();
   int input_channel_offset = reverse_dimensions() ? top_dim_ / conv_in_channels_ : bottom_dim_ / conv_in_channels_;
   int weights_per_col = kernel_dim_ / conv_in_channels_;
   int input_channels = conv_in_channels_;
-  Dtype* channel_weights (new Dtype[conv_out_channels_ * weights_per_col]);
 
   for (int channel_num = 0; channel_num < input_channels; ++channel_num) {
-    get_col_from_row_major_matrix(weights, channel_weights, kernel_dim_, conv_out_channels_, weights_per_col, channel_num);
-    for (int g = 0; g < group_; ++g) {
-      caffe_cpu_gemm<Dtype>(CblasTrans, 
-                            CblasNoTrans, 
-                            kernel_dim_ / conv_in_channels_,  
-                            conv_out_spatial_dim_,            
-                            conv_out_channels_ / group_,               
-                            (Dtype)1.,                       
-                            channel_weights + weight_offset_ * g,  
-                            output + output_offset_ * g,                          
-                            (Dtype)0.,                       
-                            col_buff + col_offset_ * g + (channel_num * input_channel_offset * is_1x1_));                       
+    const Dtype* channel_weights = weights + channel_num * weights_per_col;
+    if (partial_tile_rows_ < conv_out_outer_dim_) {
+      // tiles are accumulated into the input channel by conv_col2im_tile_cpu
+      caffe_set(input_channel_offset, Dtype(0), input + channel_num * input_channel_offset);
     }
-    if (!is_1x1_) {
-      conv_in_channels_ = 1;
-      conv_col2im_cpu(col_buff, input + channel_num * input_channel_offset);
-      conv_in_channels_ = input_channels;
+    for (int tile_start = 0; tile_start < conv_out_outer_dim_; tile_start += partial_tile_rows_) {
+      const int tile_rows = std::min(partial_tile_rows_, conv_out_outer_dim_ - tile_start);
+      const int tile_dim = tile_rows * conv_out_inner_dim_;
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasTrans, 
+                              CblasNoTrans, 
+                              weights_per_col,
+                              tile_dim,
+                              conv_out_channels_ / group_,               
+                              (Dtype)1.,                       
+                              channel_weights + weight_offset_ * g,  
+                              kernel_dim_,
+                              output + output_offset_ * g + tile_start * conv_out_inner_dim_,
+                              conv_out_spatial_dim_,
+                              (Dtype)0.,                       
+                              col_buff + col_offset_ * g + (channel_num * input_channel_offset * is_1x1_),
+                              tile_dim);
+      }
+      if (!is_1x1_) {
+        conv_in_channels_ = 1;
+        conv_col2im_tile_cpu(col_buff, tile_start, tile_rows, input + channel_num * input_channel_offset);
+        conv_in_channels_ = input_channels;
+      }
     }
   }
-  delete[] channel_weights;
 }
 
 template <typename Dtype>
-void BaseConvolutionLayer<Dtype>::full_backward_cpu_gemm(const Dtype* output, const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_.mutable_cpu_data();
+void BaseConvolutionLayer<Dtype>::full_backward_cpu_gemm(const Dtype* output, const Dtype* weights, Dtype* input, Dtype* col_data) {
+  Dtype* col_buff = col_data ? col_data : col_buffer_.mutable_cpu_data();
   if (is_1x1_) {
     col_buff = input;
   }
@@ -417,43 +618,51 @@ void BaseConvolutionLayer<Dtype>::partial_weight_cpu_gemm(const Dtype* input, co
   
   int weights_per_col = kernel_dim_ / conv_in_channels_;
   int input_channel_offset = reverse_dimensions() ? top_dim_ / conv_in_channels_ : bottom_dim_ / conv_in_channels_;
-  Dtype* channel_weights (new Dtype[conv_out_channels_ * weights_per_col]);
   int input_channels = conv_in_channels_;
 
   for (int channel_num = 0; channel_num < input_channels; ++channel_num) {
-    if (!is_1x1_) {
-      conv_in_channels_ = 1;    //this variable is used when im2col_cpu is called by conv_im2col_cpu
-      conv_im2col_cpu(input + channel_num * input_channel_offset, col_buffer_.mutable_cpu_data());
-      conv_in_channels_ = input_channels;
-      col_buff = col_buffer_.cpu_data();
-    } 
-    else {
-      col_buff = input + channel_num * input_channel_offset;
-    } 
-    for (int g = 0; g < group_; ++g) {
-      caffe_cpu_gemm<Dtype>(CblasNoTrans,                          // CBLAS_TRANSPOSE TransA
-                            CblasTrans,                            // CBLAS_TRANSPOSE TransB
-                            conv_out_channels_ / group_,           // M  (# A and C rows)
-                            kernel_dim_ / conv_in_channels_,       // N  (# B and C columns)
-                            conv_out_spatial_dim_,                 // K  (# A columns, # B rows)       
-                            (Dtype)1.,                             // alpha
-                            output + output_offset_ * g,           // A
-                            col_buff + col_offset_ * g,            // B 
-                            (Dtype)0.,                             // beta
-                            channel_weights + weight_offset_ * g); // C
+    // the channel's gradient column is accumulated in place, like full_weight_cpu_gemm
+    Dtype* channel_weights = weights + channel_num * weights_per_col;
+    for (int tile_start = 0; tile_start < conv_out_outer_dim_; tile_start += partial_tile_rows_) {
+      const int tile_rows = std::min(partial_tile_rows_, conv_out_outer_dim_ - tile_start);
+      const int tile_dim = tile_rows * conv_out_inner_dim_;
+      if (!is_1x1_) {
+        conv_in_channels_ = 1;    //this variable is used when im2col_cpu is called by conv_im2col_cpu
+        conv_im2col_tile_cpu(input + channel_num * input_channel_offset, tile_start, tile_rows, col_buffer_.mutable_cpu_data());
+        conv_in_channels_ = input_channels;
+        col_buff = col_buffer_.cpu_data();
+      } 
+      else {
+        col_buff = input + channel_num * input_channel_offset;
+      } 
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans,                          // CBLAS_TRANSPOSE TransA
+                              CblasTrans,                            // CBLAS_TRANSPOSE TransB
+                              conv_out_channels_ / group_,           // M  (# A and C rows)
+                              weights_per_col,                       // N  (# B and C columns)
+                              tile_dim,                              // K  (# A columns, # B rows)
+                              (Dtype)1.,                             // alpha
+                              output + output_offset_ * g + tile_start * conv_out_inner_dim_,  // A
+                              conv_out_spatial_dim_,                 // lda
+                              col_buff + col_offset_ * g,            // B 
+                              tile_dim,                              // ldb
+                              (Dtype)1.,                             // beta
+                              channel_weights + weight_offset_ * g,  // C
+                              kernel_dim_);                          // ldc
+      }
     }
-    //transpose add column back to existing weights for update 
-    add_col_to_row_major_matrix(weights, channel_weights, kernel_dim_, conv_out_channels_, weights_per_col , channel_num);  
   }
-  delete[] channel_weights;
 }
 
 template <typename Dtype>
-void BaseConvolutionLayer<Dtype>::full_weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype* weights) {
+void BaseConvolutionLayer<Dtype>::full_weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype* weights, Dtype* col_data) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
-    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
-    col_buff = col_buffer_.cpu_data();
+    if (!col_data) {
+      col_data = col_buffer_.mutable_cpu_data();
+    }
+    conv_im2col_cpu(input, col_data);
+    col_buff = col_data;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
@@ -463,6 +672,78 @@ void BaseConvolutionLayer<Dtype>::full_weight_cpu_gemm(const Dtype* input, const
   }
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_gemm_batch(const Dtype* input,
+    const Dtype* weights, Dtype* output, const int batch) {
+  if (batch == 1) {
+    forward_cpu_gemm(input, weights, output);
+    return;
+  }
+  const int batch_dim = batch * conv_out_spatial_dim_;
+  Dtype* col_buff = batch_col_buffer_.mutable_cpu_data();
+  Dtype* output_buff = batch_output_buffer_.mutable_cpu_data();
+  conv_im2col_batch_cpu(input, batch, col_buff);
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ / group_,
+        batch_dim, kernel_dim_,
+        (Dtype)1., weights + weight_offset_ * g, col_buff + col_offset_ * batch * g,
+        (Dtype)0., output_buff + output_offset_ * batch * g);
+  }
+  for (int b = 0; b < batch; ++b) {
+    copy_rows_cpu(conv_out_channels_, conv_out_spatial_dim_,
+        output_buff + b * conv_out_spatial_dim_, batch_dim,
+        output + b * top_dim_, conv_out_spatial_dim_);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_gemm_batch(const Dtype* output,
+    const Dtype* weights, Dtype* input, const int batch) {
+  if (batch == 1) {
+    backward_cpu_gemm(output, weights, input);
+    return;
+  }
+  const int batch_dim = batch * conv_out_spatial_dim_;
+  Dtype* col_buff = batch_col_buffer_.mutable_cpu_data();
+  Dtype* output_buff = batch_output_buffer_.mutable_cpu_data();
+  for (int b = 0; b < batch; ++b) {
+    copy_rows_cpu(conv_out_channels_, conv_out_spatial_dim_,
+        output + b * top_dim_, conv_out_spatial_dim_,
+        output_buff + b * conv_out_spatial_dim_, batch_dim);
+  }
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_,
+        batch_dim, conv_out_channels_ / group_,
+        (Dtype)1., weights + weight_offset_ * g, output_buff + output_offset_ * batch * g,
+        (Dtype)0., col_buff + col_offset_ * batch * g);
+  }
+  conv_col2im_batch_cpu(col_buff, batch, input);
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_gemm_batch(const Dtype* input,
+    const Dtype* output, Dtype* weights, const int batch) {
+  if (batch == 1) {
+    weight_cpu_gemm(input, output, weights);
+    return;
+  }
+  const int batch_dim = batch * conv_out_spatial_dim_;
+  Dtype* col_buff = batch_col_buffer_.mutable_cpu_data();
+  Dtype* output_buff = batch_output_buffer_.mutable_cpu_data();
+  conv_im2col_batch_cpu(input, batch, col_buff);
+  for (int b = 0; b < batch; ++b) {
+    copy_rows_cpu(conv_out_channels_, conv_out_spatial_dim_,
+        output + b * top_dim_, conv_out_spatial_dim_,
+        output_buff + b * conv_out_spatial_dim_, batch_dim);
+  }
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
+        kernel_dim_, batch_dim,
+        (Dtype)1., output_buff + output_offset_ * batch * g, col_buff + col_offset_ * batch * g,
+        (Dtype)1., weights + weight_offset_ * g);
+  }
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
     const Dtype* input) {
@@ -478,18 +759,11 @@ void BaseConvolutionLayer<Dtype>::partial_forward_gpu_gemm(const Dtype* input, c
   int input_channel_offset = reverse_dimensions() ? top_dim_ / conv_in_channels_ : bottom_dim_ / conv_in_channels_;
   int weights_per_col = kernel_dim_ / conv_in_channels_;
   Dtype gemm_beta = 0.;
-  int cuda_weight_col_mem_count = conv_out_channels_ * weights_per_col ;
-
-  //transposed channel weights on gpu
-  Dtype* channel_weights;
-  CUDA_CHECK( cudaMalloc(&channel_weights, cuda_weight_col_mem_count * sizeof(Dtype)) ); 
 
-  // weight data is organized into <conv_in_channels> total columns, each of which is <conv_out_channels>
-  // tall.  This 2d matrix is flattened out and stored in the weights matrix.
-  // the weights channel matrix will iterate through 0 -
+  // see partial_forward_cpu_gemm
   int input_channels = conv_in_channels_;
   for (int channel_num = 0; channel_num < input_channels; ++channel_num) {
-    caffe_gpu_get_col(cuda_weight_col_mem_count, weights, channel_weights, kernel_dim_, conv_out_channels_, weights_per_col, channel_num);    
+    const Dtype* channel_weights = weights + channel_num * weights_per_col;
     if (!is_1x1_) {
       conv_in_channels_ = 1;    //this variable is used when im2col_cpu is called by conv_im2col_gpu for 2d convolution
       conv_im2col_gpu(input + channel_num * input_channel_offset, col_buffer_.mutable_gpu_data());
@@ -504,17 +778,19 @@ void BaseConvolutionLayer<Dtype>::partial_forward_gpu_gemm(const Dtype* input, c
                             CblasNoTrans,                         // CBLAS_TRANSPOSE TransB
                             conv_out_channels_ / group_,          // M  (# A and C rows)
                             conv_out_spatial_dim_,                // N  (# B and C columns)
-                            kernel_dim_ / conv_in_channels_,      // K  (# A columns, # B rows)       
+                            weights_per_col,                      // K  (# A columns, # B rows)
                             (Dtype)1.,                            // alpha
                             channel_weights + weight_offset_ * g, // A : m rows by k columns
-                            col_buff + col_offset_ * g,           // B : k rows by n columns  
+                            kernel_dim_,                          // lda
+                            col_buff + col_offset_ * g,           // B : k rows by n columns
+                            conv_out_spatial_dim_,                // ldb
                             gemm_beta,                            // beta
-                            output + output_offset_ * g);         // C : m rows by n columns = alpha * A * B + beta * C
+                            output + output_offset_ * g,          // C : m rows by n columns = alpha * A * B + beta * C
+                            conv_out_spatial_dim_);               // ldc
       
     }
     if(channel_num == 0) gemm_beta = 1.;
   }    
-  CUDA_CHECK( cudaFree(channel_weights) );  //release transposed column
 }
 
 template <typename Dtype>
@@ -547,25 +823,23 @@ void BaseConvolutionLayer<Dtype>::partial_backward_gpu_gemm(const Dtype* output,
   int input_channel_offset = reverse_dimensions() ? top_dim_ / conv_in_channels_ : bottom_dim_ / conv_in_channels_;
   int weights_per_col = kernel_dim_ / conv_in_channels_;
   int input_channels = conv_in_channels_;
-  int cuda_weight_col_mem_count = conv_out_channels_ * weights_per_col ;
-
-  //transposed channel weights on gpu
-  Dtype* channel_weights;
-  CUDA_CHECK( cudaMalloc(&channel_weights, cuda_weight_col_mem_count * sizeof(Dtype)) );
 
   for (int channel_num = 0; channel_num < input_channels; ++channel_num) {
-    caffe_gpu_get_col(cuda_weight_col_mem_count, weights, channel_weights, kernel_dim_, conv_out_channels_, weights_per_col, channel_num);
+    const Dtype* channel_weights = weights + channel_num * weights_per_col;
     for (int g = 0; g < group_; ++g) {
       caffe_gpu_gemm<Dtype>(CblasTrans, 
                             CblasNoTrans, 
-                            kernel_dim_ / conv_in_channels_,  
+                            weights_per_col,
                             conv_out_spatial_dim_,            
                             conv_out_channels_ / group_,               
                             (Dtype)1.,                       
                             channel_weights + weight_offset_ * g,  
+                            kernel_dim_,
                             output + output_offset_ * g,                          
+                            conv_out_spatial_dim_,
                             (Dtype)0.,                       
-                            col_buff + col_offset_ * g + (channel_num * input_channel_offset * is_1x1_));                       
+                            col_buff + col_offset_ * g + (channel_num * input_channel_offset * is_1x1_),
+                            conv_out_spatial_dim_);
     }
     if (!is_1x1_) {
       conv_in_channels_ = 1;
@@ -573,7 +847,6 @@ void BaseConvolutionLayer<Dtype>::partial_backward_gpu_gemm(const Dtype* output,
       conv_in_channels_ = input_channels;
     }
   }
-  CUDA_CHECK( cudaFree(channel_weights) );  //release transposed column
 }
 
 template <typename Dtype>
@@ -599,12 +872,9 @@ void BaseConvolutionLayer<Dtype>::partial_weight_gpu_gemm(const Dtype* input, co
   int weights_per_col = kernel_dim_ / conv_in_channels_;
   int input_channel_offset = reverse_dimensions() ? top_dim_ / conv_in_channels_ : bottom_dim_ / conv_in_channels_;
   int input_channels = conv_in_channels_;
-  int cuda_weight_col_mem_count = conv_out_channels_ * weights_per_col ;
-  
-  Dtype* channel_weights;
-  CUDA_CHECK( cudaMalloc(&channel_weights, cuda_weight_col_mem_count * sizeof(Dtype)) );
 
   for (int channel_num = 0; channel_num < input_channels; ++channel_num) {
+    Dtype* channel_weights = weights + channel_num * weights_per_col;
     if (!is_1x1_) {
       conv_in_channels_ = 1;    //this variable is used when im2col_cpu is called by conv_im2col_cpu
       conv_im2col_gpu(input + channel_num * input_channel_offset, col_buffer_.mutable_gpu_data());
@@ -618,18 +888,18 @@ void BaseConvolutionLayer<Dtype>::partial_weight_gpu_gemm(const Dtype* input, co
       caffe_gpu_gemm<Dtype>(CblasNoTrans,                          // CBLAS_TRANSPOSE TransA
                             CblasTrans,                            // CBLAS_TRANSPOSE TransB
                             conv_out_channels_ / group_,           // M  (# A and C rows)
-                            kernel_dim_ / conv_in_channels_,       // N  (# B and C columns)
-                            conv_out_spatial_dim_,                 // K  (# A columns, # B rows)       
+                            weights_per_col,                       // N  (# B and C columns)
+                            conv_out_spatial_dim_,                 // K  (# A columns, # B rows)
                             (Dtype)1.,                             // alpha
                             output + output_offset_ * g,           // A
-                            col_buff + col_offset_ * g,            // B 
-                            (Dtype)0.,                             // beta
-                            channel_weights + weight_offset_ * g); // C
+                            conv_out_spatial_dim_,                 // lda
+                            col_buff + col_offset_ * g,            // B
+                            conv_out_spatial_dim_,                 // ldb
+                            (Dtype)1.,                             // beta
+                            channel_weights + weight_offset_ * g,  // C
+                            kernel_dim_);                          // ldc
     }
-    //transpose add column back to existing weights for update 
-    caffe_gpu_add_col(cuda_weight_col_mem_count, weights, channel_weights, kernel_dim_, conv_out_channels_, weights_per_col, channel_num);
   }
-  CUDA_CHECK( cudaFree(channel_weights) );  //release transposed column
 }
 
 template <typename Dtype>
@@ -47,6 +47,18 @@ BasePrefetchingDataLayer<Dtype>::BasePrefetchingDataLayer(
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  // Setting up again stops prefetching and discards the prefetched batches,
+  // which may be in either queue or in use.
+  if (is_started()) {
+    StopInternalThread();
+    Batch<Dtype>* batch;
+    while (prefetch_free_.try_pop(&batch)) {}
+    while (prefetch_full_.try_pop(&batch)) {}
+    for (int i = 0; i < prefetch_.size(); ++i) {
+      prefetch_free_.push(prefetch_[i].get());
+    }
+    prefetch_current_ = NULL;
+  }
   BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
 
   // Before starting the prefetch thread, we make cpu_data and gpu_data
@@ -58,6 +70,9 @@ void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     if (this->output_labels_) {
       prefetch_[i]->label_.mutable_cpu_data();
     }
+    for (int j = 0; j < prefetch_[i]->extra_.size(); ++j) {
+      prefetch_[i]->extra_[j]->mutable_cpu_data();
+    }
   }
 #ifndef CPU_ONLY
   if (Caffe::mode() == Caffe::GPU) {
@@ -66,6 +81,9 @@ void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
       if (this->output_labels_) {
         prefetch_[i]->label_.mutable_gpu_data();
       }
+      for (int j = 0; j < prefetch_[i]->extra_.size(); ++j) {
+        prefetch_[i]->extra_[j]->mutable_gpu_data();
+      }
     }
   }
 #endif
@@ -94,6 +112,9 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
         if (this->output_labels_) {
           batch->label_.data().get()->async_gpu_push(stream);
         }
+        for (int j = 0; j < batch->extra_.size(); ++j) {
+          batch->extra_[j]->data().get()->async_gpu_push(stream);
+        }
         CUDA_CHECK(cudaStreamSynchronize(stream));
       }
 #endif
@@ -124,6 +145,11 @@ void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     top[1]->ReshapeLike(prefetch_current_->label_);
     top[1]->set_cpu_data(prefetch_current_->label_.mutable_cpu_data());
   }
+  for (int j = 0; j < prefetch_current_->extra_.size(); ++j) {
+    Blob<Dtype>* extra = prefetch_current_->extra_[j].get();
+    top[j + 2]->ReshapeLike(*extra);
+    top[j + 2]->set_cpu_data(extra->mutable_cpu_data());
+  }
 }
 
 #ifdef CPU_ONLY
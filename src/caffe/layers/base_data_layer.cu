@@ -19,6 +19,11 @@ void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
     top[1]->ReshapeLike(prefetch_current_->label_);
     top[1]->set_gpu_data(prefetch_current_->label_.mutable_gpu_data());
   }
+  for (int j = 0; j < prefetch_current_->extra_.size(); ++j) {
+    Blob<Dtype>* extra = prefetch_current_->extra_[j].get();
+    top[j + 2]->ReshapeLike(*extra);
+    top[j + 2]->set_gpu_data(extra->mutable_gpu_data());
+  }
 }
 
 INSTANTIATE_LAYER_GPU_FORWARD(BasePrefetchingDataLayer);
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 #include "caffe/syncedmem.hpp"
 #include "caffe/layers/conv_layer.hpp"
@@ -27,12 +28,39 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
-    for (int n = 0; n < this->num_; ++n) {
-      this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
-          top_data + n * this->top_dim_);
+    if (this->cpu_threads_ > 1) {
+      const vector<Dtype*>& col_buffers = this->thread_col_buffers();
+      const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(this->cpu_threads_)
+#endif
+      for (int n = 0; n < this->num_; ++n) {
+        this->full_forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
+            top_data + n * this->top_dim_, false,
+            col_buffers[this->cpu_thread_num()]);
+        if (this->bias_term_) {
+          this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+        }
+        if (this->fused_relu_) {
+          this->forward_cpu_relu(top_data + n * this->top_dim_);
+        }
+      }
+      continue;
+    }
+    for (int n = 0; n < this->num_; n += this->gemm_batch_) {
+      const int batch = std::min(this->gemm_batch_, this->num_ - n);
+      this->forward_cpu_gemm_batch(bottom_data + n * this->bottom_dim_, weight,
+          top_data + n * this->top_dim_, batch);
       if (this->bias_term_) {
         const Dtype* bias = this->blobs_[1]->cpu_data();
-        this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+        for (int b = n; b < n + batch; ++b) {
+          this->forward_cpu_bias(top_data + b * this->top_dim_, bias);
+        }
+      }
+      if (this->fused_relu_) {
+        for (int b = n; b < n + batch; ++b) {
+          this->forward_cpu_relu(top_data + b * this->top_dim_);
+        }
       }
     }
   }
@@ -54,17 +82,43 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
         this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
       }
     }
-    if (this->param_propagate_down_[0] || propagate_down[i]) {
+    if (this->cpu_threads_ > 1 &&
+        (this->param_propagate_down_[0] || propagate_down[i])) {
+      // each thread accumulates its images' weight gradient separately
+      const vector<Dtype*>& col_buffers = this->thread_col_buffers();
+      Dtype* thread_diffs = this->param_propagate_down_[0] ?
+          this->thread_weight_diffs() : NULL;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(this->cpu_threads_)
+#endif
       for (int n = 0; n < this->num_; ++n) {
+        const int thread = this->cpu_thread_num();
+        if (this->param_propagate_down_[0]) {
+          this->full_weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
+              top_diff + n * this->top_dim_,
+              thread_diffs + thread * this->blobs_[0]->count(),
+              col_buffers[thread]);
+        }
+        if (propagate_down[i]) {
+          this->full_backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
+              bottom_diff + n * this->bottom_dim_, col_buffers[thread]);
+        }
+      }
+      if (this->param_propagate_down_[0]) {
+        this->reduce_thread_weight_diffs(thread_diffs, weight_diff);
+      }
+    } else if (this->param_propagate_down_[0] || propagate_down[i]) {
+      for (int n = 0; n < this->num_; n += this->gemm_batch_) {
+        const int batch = std::min(this->gemm_batch_, this->num_ - n);
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
-          this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
-              top_diff + n * this->top_dim_, weight_diff);
+          this->weight_cpu_gemm_batch(bottom_data + n * this->bottom_dim_,
+              top_diff + n * this->top_dim_, weight_diff, batch);
         }
         // gradient w.r.t. bottom data, if necessary.
         if (propagate_down[i]) {
-          this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
-              bottom_diff + n * this->bottom_dim_);
+          this->backward_cpu_gemm_batch(top_diff + n * this->top_dim_, weight,
+              bottom_diff + n * this->bottom_dim_, batch);
         }
       }
     }
@@ -8,13 +8,19 @@
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
 template <typename Dtype>
 DataLayer<Dtype>::DataLayer(const LayerParameter& param)
   : BasePrefetchingDataLayer<Dtype>(param),
-    offset_() {
+    offset_(),
+    cache_items_(0),
+    cache_copy_(false),
+    cache_full_(false),
+    cache_pos_(0) {
   db_.reset(db::GetDB(param.data_param().backend()));
   db_->Open(param.data_param().source(), db::READ);
   cursor_.reset(db_->NewCursor());
@@ -31,7 +37,10 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   const int batch_size = this->layer_param_.data_param().batch_size();
   // Read a data point, and use it to initialize the top blob.
   Datum datum;
-  datum.ParseFromString(cursor_->value());
+  const char* value;
+  size_t value_size;
+  cursor_->value_view(&value, &value_size);
+  datum.ParseFromArray(value, value_size);
 
   // Use data_transformer to infer the expected blob shape from datum.
   vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
@@ -54,6 +63,68 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       this->prefetch_[i]->label_.Reshape(label_shape);
     }
   }
+  const int decode_threads = this->layer_param_.data_param().decode_threads();
+  CHECK_GE(decode_threads, 1) << "decode_threads must be positive.";
+  const bool cache = this->layer_param_.data_param().cache();
+  CHECK(cache || !this->layer_param_.data_param().shuffle())
+      << "shuffle requires cache.";
+  if (!cache) {
+    transformers_.assign(1, this->data_transformer_);
+    for (int i = 1; i < decode_threads; ++i) {
+      transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+          new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+      transformers_.back()->InitRand();
+    }
+  } else {
+    // Split the transformation into its deterministic part, applied once
+    // when caching the items, and its random part, applied when serving them.
+    TransformationParameter cache_param = this->transform_param_;
+    TransformationParameter serve_param;
+    cache_param.set_mirror(false);
+    serve_param.set_mirror(this->transform_param_.mirror());
+    if (this->phase_ == TRAIN) {
+      cache_param.clear_crop_size();
+      serve_param.set_crop_size(this->transform_param_.crop_size());
+    }
+    NewTransformers(cache_param, &cache_transformers_);
+    NewTransformers(serve_param, &transformers_);
+    cache_shape_ = cache_transformers_[0]->InferBlobShape(datum);
+    cache_copy_ = !serve_param.mirror() && !serve_param.crop_size();
+    CHECK(cache_copy_ || cache_shape_.size() == 4)
+        << "cache only crops and mirrors 2-D Datums at TRAIN time.";
+    if (this->layer_param_.data_param().shuffle()) {
+      const unsigned int prefetch_rng_seed = caffe_rng_rand();
+      prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+    }
+    batch_items_.resize(batch_size);
+  }
+  datums_.resize(batch_size);
+  values_.resize(batch_size);
+  value_sizes_.resize(batch_size);
+  if (!cursor_->stable_views()) {
+    value_copies_.resize(batch_size);
+  }
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::NewTransformers(const TransformationParameter& param,
+    vector<shared_ptr<DataTransformer<Dtype> > >* transformers) {
+  const int decode_threads = this->layer_param_.data_param().decode_threads();
+  transformers->clear();
+  for (int i = 0; i < decode_threads; ++i) {
+    transformers->push_back(shared_ptr<DataTransformer<Dtype> >(
+        new DataTransformer<Dtype>(param, this->phase_)));
+    transformers->back()->InitRand();
+  }
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::ViewValue(int item_id) {
+  cursor_->value_view(&values_[item_id], &value_sizes_[item_id]);
+  if (!value_copies_.empty()) {
+    value_copies_[item_id].assign(values_[item_id], value_sizes_[item_id]);
+    values_[item_id] = value_copies_[item_id].data();
+  }
 }
 
 template <typename Dtype>
@@ -73,6 +144,7 @@ void DataLayer<Dtype>::Next() {
     LOG_IF(INFO, Caffe::root_solver())
         << "Restarting data prefetching from start.";
     cursor_->SeekToFirst();
+    cache_full_ = this->layer_param_.data_param().cache();
   }
   offset_++;
 }
@@ -80,6 +152,10 @@ void DataLayer<Dtype>::Next() {
 // This function is called on prefetch thread
 template<typename Dtype>
 void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
+  if (this->layer_param_.data_param().cache()) {
+    load_cached_batch(batch);
+    return;
+  }
   CPUTimer batch_timer;
   batch_timer.Start();
   double read_time = 0;
@@ -89,40 +165,167 @@ void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CHECK(this->transformed_data_.count());
   const int batch_size = this->layer_param_.data_param().batch_size();
 
-  Datum datum;
+  // Gather views of the items for the decode threads to parse straight from
+  // the DB (LMDB), or from a copy if the views do not last (LevelDB). The
+  // first item is parsed here for the shape of the batch.
+  timer.Start();
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    timer.Start();
     while (Skip()) {
       Next();
     }
-    datum.ParseFromString(cursor_->value());
-    read_time += timer.MicroSeconds();
-
-    if (item_id == 0) {
-      // Reshape according to the first datum of each batch
-      // on single input batches allows for inputs of varying dimension.
-      // Use data_transformer to infer the expected blob shape from datum.
-      vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
-      this->transformed_data_.Reshape(top_shape);
-      // Reshape batch according to the batch_size.
-      top_shape[0] = batch_size;
-      batch->data_.Reshape(top_shape);
+    ViewValue(item_id);
+    Next();
+  }
+  datums_[0].ParseFromArray(values_[0], value_sizes_[0]);
+  read_time += timer.MicroSeconds();
+
+  // Reshape according to the first datum of each batch
+  // on single input batches allows for inputs of varying dimension.
+  // Use data_transformer to infer the expected blob shape from datum.
+  vector<int> top_shape = this->data_transformer_->InferBlobShape(datums_[0]);
+  this->transformed_data_.Reshape(top_shape);
+  // Reshape batch according to the batch_size.
+  top_shape[0] = batch_size;
+  batch->data_.Reshape(top_shape);
+
+  // Parse the items and apply data transformations (mirror, scale, crop...),
+  // each decode thread on its own contiguous slice of the batch with its own
+  // transformer.
+  timer.Start();
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label =
+      this->output_labels_ ? batch->label_.mutable_cpu_data() : NULL;
+  const int num_workers = transformers_.size();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_workers) schedule(static, 1)
+#endif
+  for (int worker = 0; worker < num_workers; ++worker) {
+    Blob<Dtype> transformed_data(this->transformed_data_.shape());
+    for (int item_id = worker * batch_size / num_workers;
+         item_id < (worker + 1) * batch_size / num_workers; ++item_id) {
+      if (item_id > 0) {
+        datums_[item_id].ParseFromArray(values_[item_id],
+            value_sizes_[item_id]);
+      }
+      transformed_data.set_cpu_data(top_data + batch->data_.offset(item_id));
+      transformers_[worker]->Transform(datums_[item_id], &transformed_data);
+      // Copy label.
+      if (top_label) {
+        top_label[item_id] = datums_[item_id].label();
+      }
     }
+  }
+  trans_time += timer.MicroSeconds();
+  timer.Stop();
+  batch_timer.Stop();
+  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
+  DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
+  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+}
+
+// This function is called on prefetch thread
+template<typename Dtype>
+void DataLayer<Dtype>::load_cached_batch(Batch<Dtype>* batch) {
+  CPUTimer batch_timer;
+  batch_timer.Start();
+  double read_time = 0;
+  double trans_time = 0;
+  CPUTimer timer;
+  const int batch_size = this->layer_param_.data_param().batch_size();
+  int cache_dim = 1;
+  for (int i = 1; i < cache_shape_.size(); ++i) {
+    cache_dim *= cache_shape_[i];
+  }
 
-    // Apply data transformations (mirror, scale, crop...)
-    timer.Start();
-    int offset = batch->data_.offset(item_id);
-    Dtype* top_data = batch->data_.mutable_cpu_data();
-    this->transformed_data_.set_cpu_data(top_data + offset);
-    this->data_transformer_->Transform(datum, &(this->transformed_data_));
-    // Copy label.
-    if (this->output_labels_) {
-      Dtype* top_label = batch->label_.mutable_cpu_data();
-      top_label[item_id] = datum.label();
+  // During the first epoch, read the items from the DB and add them to the
+  // cache. Afterwards, take them from the cache in the order of cache_order_.
+  timer.Start();
+  const int first_new_item = cache_items_;
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    while (!cache_full_ && Skip()) {
+      Next();
+    }
+    if (!cache_full_) {
+      ViewValue(cache_items_ - first_new_item);
+      batch_items_[item_id] = cache_items_++;
+      Next();
+      continue;
+    }
+    if (cache_pos_ == cache_order_.size()) {
+      if (cache_order_.empty()) {
+        CHECK_GT(cache_items_, 0) << "No Datum to cache.";
+        LOG_IF(INFO, Caffe::root_solver())
+            << "Cached " << cache_items_ << " items ("
+            << cache_items_ * cache_dim * sizeof(Dtype) / 1048576
+            << " MB); serving the following epochs from memory.";
+        for (int i = 0; i < cache_items_; ++i) {
+          cache_order_.push_back(i);
+        }
+      }
+      if (prefetch_rng_) {
+        caffe::rng_t* prefetch_rng =
+            static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+        shuffle(cache_order_.begin(), cache_order_.end(), prefetch_rng);
+      }
+      cache_pos_ = 0;
+    }
+    batch_items_[item_id] = cache_order_[cache_pos_++];
+  }
+  const int num_new_items = cache_items_ - first_new_item;
+  cache_data_.resize(static_cast<size_t>(cache_items_) * cache_dim);
+  cache_labels_.resize(cache_items_);
+  read_time += timer.MicroSeconds();
+
+  // Parse and cache the new items, then copy the items of the batch out of
+  // the cache, cropping and mirroring them if needed, each decode thread on
+  // its own contiguous slice of the items with its own transformer.
+  timer.Start();
+  const int num_workers = transformers_.size();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_workers) schedule(static, 1)
+#endif
+  for (int worker = 0; worker < num_workers; ++worker) {
+    Blob<Dtype> cached_data(cache_shape_);
+    for (int i = worker * num_new_items / num_workers;
+         i < (worker + 1) * num_new_items / num_workers; ++i) {
+      const int index = first_new_item + i;
+      datums_[i].ParseFromArray(values_[i], value_sizes_[i]);
+      cached_data.set_cpu_data(
+          &cache_data_[static_cast<size_t>(index) * cache_dim]);
+      cache_transformers_[worker]->Transform(datums_[i], &cached_data);
+      cache_labels_[index] = datums_[i].label();
+    }
+  }
+  vector<int> top_shape = this->transformed_data_.shape();
+  top_shape[0] = batch_size;
+  batch->data_.Reshape(top_shape);
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label =
+      this->output_labels_ ? batch->label_.mutable_cpu_data() : NULL;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_workers) schedule(static, 1)
+#endif
+  for (int worker = 0; worker < num_workers; ++worker) {
+    Blob<Dtype> cached_data(cache_shape_);
+    Blob<Dtype> transformed_data(this->transformed_data_.shape());
+    for (int item_id = worker * batch_size / num_workers;
+         item_id < (worker + 1) * batch_size / num_workers; ++item_id) {
+      const int index = batch_items_[item_id];
+      Dtype* item_data = &cache_data_[static_cast<size_t>(index) * cache_dim];
+      Dtype* top_item = top_data + batch->data_.offset(item_id);
+      if (cache_copy_) {
+        caffe_copy(cache_dim, item_data, top_item);
+      } else {
+        cached_data.set_cpu_data(item_data);
+        transformed_data.set_cpu_data(top_item);
+        transformers_[worker]->Transform(&cached_data, &transformed_data);
+      }
+      if (top_label) {
+        top_label[item_id] = cache_labels_[index];
+      }
     }
-    trans_time += timer.MicroSeconds();
-    Next();
   }
+  trans_time += timer.MicroSeconds();
   timer.Stop();
   batch_timer.Stop();
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
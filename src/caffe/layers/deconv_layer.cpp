@@ -28,6 +28,22 @@ void DeconvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
+    if (this->cpu_threads_ > 1) {
+      const vector<Dtype*>& col_buffers = this->thread_col_buffers();
+      const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(this->cpu_threads_)
+#endif
+      for (int n = 0; n < this->num_; ++n) {
+        this->full_backward_cpu_gemm(bottom_data + n * this->bottom_dim_,
+            weight, top_data + n * this->top_dim_,
+            col_buffers[this->cpu_thread_num()]);
+        if (this->bias_term_) {
+          this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+        }
+      }
+      continue;
+    }
     for (int n = 0; n < this->num_; ++n) {
       this->backward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
           top_data + n * this->top_dim_);
@@ -55,7 +71,33 @@ void DeconvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
         this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
       }
     }
-    if (this->param_propagate_down_[0] || propagate_down[i]) {
+    if (this->cpu_threads_ > 1 &&
+        (this->param_propagate_down_[0] || propagate_down[i])) {
+      // each thread accumulates its images' weight gradient separately
+      const vector<Dtype*>& col_buffers = this->thread_col_buffers();
+      Dtype* thread_diffs = this->param_propagate_down_[0] ?
+          this->thread_weight_diffs() : NULL;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(this->cpu_threads_)
+#endif
+      for (int n = 0; n < this->num_; ++n) {
+        const int thread = this->cpu_thread_num();
+        if (this->param_propagate_down_[0]) {
+          this->full_weight_cpu_gemm(top_diff + n * this->top_dim_,
+              bottom_data + n * this->bottom_dim_,
+              thread_diffs + thread * this->blobs_[0]->count(),
+              col_buffers[thread]);
+        }
+        if (propagate_down[i]) {
+          this->full_forward_cpu_gemm(top_diff + n * this->top_dim_, weight,
+              bottom_diff + n * this->bottom_dim_,
+              this->param_propagate_down_[0], col_buffers[thread]);
+        }
+      }
+      if (this->param_propagate_down_[0]) {
+        this->reduce_thread_weight_diffs(thread_diffs, weight_diff);
+      }
+    } else if (this->param_propagate_down_[0] || propagate_down[i]) {
       for (int n = 0; n < this->num_; ++n) {
         // Gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
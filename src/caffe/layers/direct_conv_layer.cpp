@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/direct_conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// Number of output channels accumulated together by the direct kernel.
+static const int kDirectBlock = 4;
+
+// The range [begin, end) of output positions along one axis for which the tap
+// at offset (kernel index * dilation - pad) reads inside [0, in_dim).
+static inline void direct_valid_range(const int in_dim, const int out_dim,
+    const int stride, const int offset, int* begin, int* end) {
+  *begin = (offset >= 0) ? 0 : (stride - 1 - offset) / stride;
+  *end = (offset >= in_dim) ? 0 :
+      std::min(out_dim, (in_dim - 1 - offset) / stride + 1);
+  *end = std::max(*begin, *end);
+}
+
+// out[j][i] += w[j] * in[i * stride] for i < count and the B output rows.
+template <typename Dtype, int B>
+static inline void direct_conv_row(const int count, const int stride,
+    const Dtype* in, const Dtype* w, Dtype* const* out) {
+  if (stride == 1) {
+    for (int i = 0; i < count; ++i) {
+      const Dtype x = in[i];
+      for (int j = 0; j < B; ++j) {
+        out[j][i] += w[j] * x;
+      }
+    }
+  } else {
+    for (int i = 0; i < count; ++i) {
+      const Dtype x = in[i * stride];
+      for (int j = 0; j < B; ++j) {
+        out[j][i] += w[j] * x;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::forward_cpu_direct(const Dtype* input,
+    const Dtype* weights, const Dtype* bias, Dtype* output) {
+  // 2-D inputs are handled as 3-D inputs with a single slice.
+  int in_shape[3] = {1, 1, 1};
+  int out_shape[3] = {1, 1, 1};
+  int kernel[3] = {1, 1, 1};
+  int stride[3] = {1, 1, 1};
+  int pad[3] = {0, 0, 0};
+  int dilation[3] = {1, 1, 1};
+  const int* kernel_shape_data = this->kernel_shape_.cpu_data();
+  const int* stride_data = this->stride_.cpu_data();
+  const int* pad_data = this->pad_.cpu_data();
+  const int* dilation_data = this->dilation_.cpu_data();
+  for (int i = 0; i < this->num_spatial_axes_; ++i) {
+    const int axis = 3 - this->num_spatial_axes_ + i;
+    in_shape[axis] = this->input_shape(i + 1);
+    out_shape[axis] = this->output_shape_[i];
+    kernel[axis] = kernel_shape_data[i];
+    stride[axis] = stride_data[i];
+    pad[axis] = pad_data[i];
+    dilation[axis] = dilation_data[i];
+  }
+  const int in_spatial_dim = in_shape[0] * in_shape[1] * in_shape[2];
+  const int out_spatial_dim = out_shape[0] * out_shape[1] * out_shape[2];
+  const int kernel_volume = kernel[0] * kernel[1] * kernel[2];
+  const int in_channels = this->channels_ / this->group_;
+  const int out_channels = this->num_output_ / this->group_;
+  const int weight_dim = in_channels * kernel_volume;
+
+  Dtype* out[kDirectBlock];
+  Dtype* out_row[kDirectBlock];
+  Dtype w[kDirectBlock];
+  for (int g = 0; g < this->group_; ++g) {
+    const Dtype* group_input = input + g * in_channels * in_spatial_dim;
+    for (int oc = g * out_channels; oc < (g + 1) * out_channels;
+         oc += kDirectBlock) {
+      const int block = std::min(kDirectBlock, (g + 1) * out_channels - oc);
+      for (int j = 0; j < block; ++j) {
+        out[j] = output + (oc + j) * out_spatial_dim;
+        caffe_set(out_spatial_dim, bias ? bias[oc + j] : Dtype(0), out[j]);
+      }
+      for (int ic = 0; ic < in_channels; ++ic) {
+        const Dtype* channel_input = group_input + ic * in_spatial_dim;
+        for (int kd = 0; kd < kernel[0]; ++kd) {
+          const int offset_d = kd * dilation[0] - pad[0];
+          int od_begin, od_end;
+          direct_valid_range(in_shape[0], out_shape[0], stride[0], offset_d,
+              &od_begin, &od_end);
+          for (int kh = 0; kh < kernel[1]; ++kh) {
+            const int offset_h = kh * dilation[1] - pad[1];
+            int oh_begin, oh_end;
+            direct_valid_range(in_shape[1], out_shape[1], stride[1], offset_h,
+                &oh_begin, &oh_end);
+            for (int kw = 0; kw < kernel[2]; ++kw) {
+              const int offset_w = kw * dilation[2] - pad[2];
+              int ow_begin, ow_end;
+              direct_valid_range(in_shape[2], out_shape[2], stride[2],
+                  offset_w, &ow_begin, &ow_end);
+              const int tap = ic * kernel_volume +
+                  (kd * kernel[1] + kh) * kernel[2] + kw;
+              for (int j = 0; j < block; ++j) {
+                w[j] = weights[(oc + j) * weight_dim + tap];
+              }
+              for (int od = od_begin; od < od_end; ++od) {
+                const int id = od * stride[0] + offset_d;
+                for (int oh = oh_begin; oh < oh_end; ++oh) {
+                  const int ih = oh * stride[1] + offset_h;
+                  const Dtype* in_row = channel_input +
+                      (id * in_shape[1] + ih) * in_shape[2] +
+                      ow_begin * stride[2] + offset_w;
+                  const int out_offset =
+                      (od * out_shape[1] + oh) * out_shape[2] + ow_begin;
+                  for (int j = 0; j < block; ++j) {
+                    out_row[j] = out[j] + out_offset;
+                  }
+                  if (block == kDirectBlock) {
+                    direct_conv_row<Dtype, kDirectBlock>(ow_end - ow_begin,
+                        stride[2], in_row, w, out_row);
+                  } else {
+                    for (int j = 0; j < block; ++j) {
+                      direct_conv_row<Dtype, 1>(ow_end - ow_begin, stride[2],
+                          in_row, w + j, out_row + j);
+                    }
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (this->partial_conv_lower_ || this->num_spatial_axes_ < 2 ||
+      this->num_spatial_axes_ > 3) {
+    ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(this->cpu_threads_) \
+    if (this->cpu_threads_ > 1)
+#endif
+    for (int n = 0; n < this->num_; ++n) {
+      forward_cpu_direct(bottom_data + n * this->bottom_dim_, weight, bias,
+          top_data + n * this->top_dim_);
+      if (this->fused_relu_) {
+        this->forward_cpu_relu(top_data + n * this->top_dim_);
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(DirectConvolutionLayer);
+
+}  // namespace caffe
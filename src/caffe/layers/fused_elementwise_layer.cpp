@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/layer_factory.hpp"
+#include "caffe/layers/fused_elementwise_layer.hpp"
+#include "caffe/util/fold_layers.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void FusedElementwiseLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const FusedElementwiseParameter& param =
+      this->layer_param_.fused_elementwise_param();
+  CHECK_GT(param.layer_size(), 0) << "Nothing to fuse.";
+  layers_.assign(param.layer().begin(), param.layer().end());
+  CHECK(StartsElementwiseChain(layers_[0]))
+      << "Cannot fuse " << layers_[0].type() << " layer " << layers_[0].name();
+  for (int i = 1; i < layers_.size(); ++i) {
+    CHECK(ContinuesElementwiseChain(layers_[i]))
+        << "Cannot fuse " << layers_[i].type() << " layer "
+        << layers_[i].name();
+  }
+  tile_size_ = param.tile_size();
+  CHECK_GT(tile_size_, 0) << "tile_size must be positive.";
+  const string& type = layers_[0].type();
+  if (type == "Eltwise") {
+    const EltwiseParameter& eltwise_param = layers_[0].eltwise_param();
+    coeffs_.assign(bottom.size(), Dtype(1));
+    if (eltwise_param.coeff_size()) {
+      CHECK_EQ(eltwise_param.coeff_size(), bottom.size())
+          << "Eltwise layer takes one coefficient per bottom blob.";
+      for (int i = 0; i < bottom.size(); ++i) {
+        coeffs_[i] = eltwise_param.coeff(i);
+      }
+    }
+  } else if ((type == "Scale" || type == "Bias") && this->blobs_.empty()) {
+    // Let the layer itself shape and fill its parameters.
+    shared_ptr<Layer<Dtype> > layer =
+        LayerRegistry<Dtype>::CreateLayer(layers_[0]);
+    layer->SetUp(bottom, top);
+    this->blobs_ = layer->blobs();
+  } else {
+    CHECK_EQ(bottom.size(), 1) << type << " layer takes a single bottom.";
+  }
+}
+
+template <typename Dtype>
+void FusedElementwiseLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  for (int i = 1; i < bottom.size(); ++i) {
+    CHECK(bottom[i]->shape() == bottom[0]->shape())
+        << "bottom[" << i << "] shape differs from bottom[0].";
+  }
+  top[0]->ReshapeLike(*bottom[0]);
+  const string& type = layers_[0].type();
+  if (type == "Scale" || type == "Bias") {
+    outer_dim_ = bottom[0]->count(0, 1);
+    channels_ = bottom[0]->shape(1);
+    inner_dim_ = bottom[0]->count(2);
+    CHECK_EQ(this->blobs_[0]->count(), channels_)
+        << type << " parameters must be per channel.";
+  } else {
+    outer_dim_ = 1;
+    channels_ = 1;
+    inner_dim_ = bottom[0]->count();
+  }
+}
+
+template <typename Dtype>
+void FusedElementwiseLayer<Dtype>::forward_head(
+    const vector<Blob<Dtype>*>& bottom, const int offset, const int count,
+    const int c, Dtype* output) {
+  const string& type = layers_[0].type();
+  const Dtype* input = bottom[0]->cpu_data() + offset;
+  if (type == "Eltwise") {
+    switch (layers_[0].eltwise_param().operation()) {
+    case EltwiseParameter_EltwiseOp_PROD:
+      caffe_mul(count, input, bottom[1]->cpu_data() + offset, output);
+      for (int i = 2; i < bottom.size(); ++i) {
+        caffe_mul(count, output, bottom[i]->cpu_data() + offset, output);
+      }
+      break;
+    case EltwiseParameter_EltwiseOp_SUM:
+      caffe_cpu_scale(count, coeffs_[0], input, output);
+      for (int i = 1; i < bottom.size(); ++i) {
+        caffe_axpy(count, coeffs_[i], bottom[i]->cpu_data() + offset, output);
+      }
+      break;
+    case EltwiseParameter_EltwiseOp_MAX:
+      caffe_copy(count, input, output);
+      for (int i = 1; i < bottom.size(); ++i) {
+        const Dtype* other = bottom[i]->cpu_data() + offset;
+        for (int j = 0; j < count; ++j) {
+          output[j] = std::max(output[j], other[j]);
+        }
+      }
+      break;
+    default:
+      LOG(FATAL) << "Unknown elementwise operation.";
+    }
+  } else if (type == "Scale") {
+    const Dtype scale = this->blobs_[0]->cpu_data()[c];
+    const Dtype shift =
+        this->blobs_.size() > 1 ? this->blobs_[1]->cpu_data()[c] : Dtype(0);
+    for (int j = 0; j < count; ++j) {
+      output[j] = scale * input[j] + shift;
+    }
+  } else if (type == "Bias") {
+    const Dtype shift = this->blobs_[0]->cpu_data()[c];
+    for (int j = 0; j < count; ++j) {
+      output[j] = input[j] + shift;
+    }
+  } else {
+    if (output != input) {
+      caffe_copy(count, input, output);
+    }
+    forward_neuron(layers_[0], count, output);
+  }
+}
+
+template <typename Dtype>
+void FusedElementwiseLayer<Dtype>::forward_neuron(const LayerParameter& param,
+    const int count, Dtype* data) {
+  const string& type = param.type();
+  if (type == "ReLU") {
+    const Dtype negative_slope = param.relu_param().negative_slope();
+    for (int j = 0; j < count; ++j) {
+      data[j] = std::max(data[j], Dtype(0))
+          + negative_slope * std::min(data[j], Dtype(0));
+    }
+  } else if (type == "Sigmoid") {
+    for (int j = 0; j < count; ++j) {
+      data[j] = 0.5 * tanh(0.5 * data[j]) + 0.5;
+    }
+  } else if (type == "TanH") {
+    for (int j = 0; j < count; ++j) {
+      data[j] = tanh(data[j]);
+    }
+  } else if (type == "AbsVal") {
+    caffe_abs(count, data, data);
+  } else if (type == "Power") {
+    const Dtype power = param.power_param().power();
+    const Dtype scale = param.power_param().scale();
+    const Dtype shift = param.power_param().shift();
+    if (power * scale == Dtype(0)) {
+      caffe_set(count, power == 0 ? Dtype(1) : Dtype(pow(shift, power)), data);
+      return;
+    }
+    for (int j = 0; j < count; ++j) {
+      data[j] = scale * data[j] + shift;
+    }
+    if (power != Dtype(1)) {
+      caffe_powx(count, data, power, data);
+    }
+  } else if (type == "ELU") {
+    const Dtype alpha = param.elu_param().alpha();
+    for (int j = 0; j < count; ++j) {
+      data[j] = std::max(data[j], Dtype(0))
+          + alpha * (exp(std::min(data[j], Dtype(0))) - Dtype(1));
+    }
+  } else {
+    LOG(FATAL) << "Cannot fuse " << type << " layer " << param.name();
+  }
+}
+
+template <typename Dtype>
+void FusedElementwiseLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  for (int n = 0; n < outer_dim_; ++n) {
+    for (int c = 0; c < channels_; ++c) {
+      for (int i = 0; i < inner_dim_; i += tile_size_) {
+        const int offset = (n * channels_ + c) * inner_dim_ + i;
+        const int count = std::min(tile_size_, inner_dim_ - i);
+        forward_head(bottom, offset, count, c, top_data + offset);
+        for (int l = 1; l < layers_.size(); ++l) {
+          forward_neuron(layers_[l], count, top_data + offset);
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(FusedElementwiseLayer);
+REGISTER_LAYER_CLASS(FusedElementwise);
+
+}  // namespace caffe
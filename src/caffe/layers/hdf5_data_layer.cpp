@@ -1,11 +1,5 @@
-/*
-TODO:
-- load file in a separate thread ("prefetch")
-- can be smarter about the memcpy call instead of doing it row-by-row
-  :: use util functions caffe_copy, and Blob->offset()
-  :: don't forget to update hdf5_daa_layer.cu accordingly
-- add ability to shuffle filenames if flag is set
-*/
+#include <boost/thread.hpp>
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
@@ -16,65 +10,145 @@ TODO:
 
 #include "caffe/layers/hdf5_data_layer.hpp"
 #include "caffe/util/hdf5.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
+// The blob of a Batch holding top i.
 template <typename Dtype>
-HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() { }
+static Blob<Dtype>* batch_blob(Batch<Dtype>* batch, int i) {
+  if (i == 0) {
+    return &batch->data_;
+  } else if (i == 1) {
+    return &batch->label_;
+  }
+  return batch->extra_[i - 2].get();
+}
 
-// Load data and label from HDF5 filename into the class property blobs.
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::LoadHDF5FileData(const char* filename) {
-  DLOG(INFO) << "Loading HDF5 file: " << filename;
-  hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-  if (file_id < 0) {
-    LOG(FATAL) << "Failed opening HDF5 file: " << filename;
+static void init_batch(int top_size, Batch<Dtype>* batch) {
+  batch->extra_.resize(std::max(top_size - 2, 0));
+  for (int i = 0; i < batch->extra_.size(); ++i) {
+    batch->extra_[i].reset(new Blob<Dtype>());
   }
+}
+
+template <typename Dtype>
+HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() {
+  this->StopInternalThread();
+  StopReader();
+}
 
-  int top_size = this->layer_param_.top_size();
-  hdf_blobs_.resize(top_size);
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::StopReader() {
+  if (reader_) {
+    reader_->interrupt();
+    reader_->join();
+    reader_.reset();
+  }
+}
 
+// Load the next chunk of rows of every top from the file at the read position.
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::LoadHDF5ChunkData(Batch<Dtype>* chunk) {
+  const char* filename = hdf_filenames_[file_permutation_[read_file_]].c_str();
+  const int top_size = this->layer_param_.top_size();
+  const int chunk_size = this->layer_param_.hdf5_data_param().chunk_size();
   const int MIN_DATA_DIM = 1;
   const int MAX_DATA_DIM = INT_MAX;
+  {
+    boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
+    DLOG(INFO) << "Loading HDF5 file: " << filename << " from row "
+               << read_row_;
+    hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file_id < 0) {
+      LOG(FATAL) << "Failed opening HDF5 file: " << filename;
+    }
+    // MinTopBlobs==1 guarantees at least one top blob
+    const vector<int> shape =
+        hdf5_get_dataset_shape(file_id, this->layer_param_.top(0));
+    CHECK_GE(shape.size(), 1) << "Input must have at least 1 axis.";
+    const hsize_t num = shape[0];
+    CHECK_GT(num, read_row_) << "No rows left in HDF5 file: " << filename;
+    for (int i = 1; i < top_size; ++i) {
+      CHECK_EQ(hdf5_get_dataset_shape(file_id,
+          this->layer_param_.top(i))[0], num);
+    }
+    const int num_rows = (chunk_size > 0) ?
+        std::min<hsize_t>(chunk_size, num - read_row_) : num - read_row_;
+    for (int i = 0; i < top_size; ++i) {
+      hdf5_load_nd_dataset_rows(file_id, this->layer_param_.top(i).c_str(),
+          MIN_DATA_DIM, MAX_DATA_DIM, read_row_, num_rows,
+          batch_blob(chunk, i));
+    }
+    herr_t status = H5Fclose(file_id);
+    CHECK_GE(status, 0) << "Failed to close HDF5 file: " << filename;
+    DLOG(INFO) << "Successfully loaded " << num_rows << " rows";
 
-  for (int i = 0; i < top_size; ++i) {
-    hdf_blobs_[i] = shared_ptr<Blob<Dtype> >(new Blob<Dtype>());
-    // Allow reshape here, as we are loading data not params
-    hdf5_load_nd_dataset(file_id, this->layer_param_.top(i).c_str(),
-        MIN_DATA_DIM, MAX_DATA_DIM, hdf_blobs_[i].get(), true);
+    read_row_ += num_rows;
+    if (read_row_ < num) {
+      return;
+    }
+  }
+  read_row_ = 0;
+  if (++read_file_ == num_files_) {
+    read_file_ = 0;
+    if (this->layer_param_.hdf5_data_param().shuffle()) {
+      caffe::rng_t* file_rng =
+          static_cast<caffe::rng_t*>(file_rng_->generator());
+      shuffle(file_permutation_.begin(), file_permutation_.end(), file_rng);
+    }
+    DLOG(INFO) << "Looping around to first file.";
   }
+}
 
-  herr_t status = H5Fclose(file_id);
-  CHECK_GE(status, 0) << "Failed to close HDF5 file: " << filename;
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::ReadChunks(int device) {
+#ifndef CPU_ONLY
+  CUDA_CHECK(cudaSetDevice(device));
+#endif
+  try {
+    while (true) {
+      Batch<Dtype>* chunk = chunk_free_.pop();
+      LoadHDF5ChunkData(chunk);
+      chunk_full_.push(chunk);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
 
-  // MinTopBlobs==1 guarantees at least one top blob
-  CHECK_GE(hdf_blobs_[0]->num_axes(), 1) << "Input must have at least 1 axis.";
-  const int num = hdf_blobs_[0]->shape(0);
-  for (int i = 1; i < top_size; ++i) {
-    CHECK_EQ(hdf_blobs_[i]->shape(0), num);
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::NextChunk() {
+  if (!single_chunk_) {
+    chunk_free_.push(chunk_current_);
+    chunk_current_ = chunk_full_.pop("Waiting for HDF5 data");
   }
+  ResetRows();
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::ResetRows() {
+  current_row_ = 0;
   // Default to identity permutation.
-  data_permutation_.clear();
-  data_permutation_.resize(hdf_blobs_[0]->shape(0));
-  for (int i = 0; i < hdf_blobs_[0]->shape(0); i++)
+  const int num = chunk_current_->data_.shape(0);
+  data_permutation_.resize(num);
+  for (int i = 0; i < num; i++)
     data_permutation_[i] = i;
-
   // Shuffle if needed.
   if (this->layer_param_.hdf5_data_param().shuffle()) {
-    std::random_shuffle(data_permutation_.begin(), data_permutation_.end());
-    DLOG(INFO) << "Successfully loaded " << hdf_blobs_[0]->shape(0)
-               << " rows (shuffled)";
-  } else {
-    DLOG(INFO) << "Successfully loaded " << hdf_blobs_[0]->shape(0) << " rows";
+    shuffle(data_permutation_.begin(), data_permutation_.end());
   }
 }
 
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+void HDF5DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   // Refuse transformation parameters since HDF5 is totally generic.
   CHECK(!this->layer_param_.has_transform_param()) <<
       this->type() << " does not transform data.";
+  StopReader();
   // Read the source to parse the filenames.
   const string& source = this->layer_param_.hdf5_data_param().source();
   LOG(INFO) << "Loading list of HDF5 filenames from: " << source;
@@ -90,7 +164,6 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   source_file.close();
   num_files_ = hdf_filenames_.size();
-  current_file_ = 0;
   LOG(INFO) << "Number of HDF5 files: " << num_files_;
   CHECK_GE(num_files_, 1) << "Must have at least 1 HDF5 filename listed in "
     << source;
@@ -104,24 +177,59 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
 
   // Shuffle if needed.
   if (this->layer_param_.hdf5_data_param().shuffle()) {
-    std::random_shuffle(file_permutation_.begin(), file_permutation_.end());
+    const unsigned int file_rng_seed = caffe_rng_rand();
+    file_rng_.reset(new Caffe::RNG(file_rng_seed));
+    caffe::rng_t* file_rng = static_cast<caffe::rng_t*>(file_rng_->generator());
+    shuffle(file_permutation_.begin(), file_permutation_.end(), file_rng);
   }
 
-  // Load the first HDF5 file and initialize the line counter.
-  LoadHDF5FileData(hdf_filenames_[file_permutation_[current_file_]].c_str());
-  current_row_ = 0;
+  // Load the first chunk, then keep reading ahead in the background unless
+  // it already holds all the data.
+  const int top_size = this->layer_param_.top_size();
+  chunks_.resize(2);
+  Batch<Dtype>* chunk;
+  while (chunk_free_.try_pop(&chunk)) {}
+  while (chunk_full_.try_pop(&chunk)) {}
+  for (int i = 0; i < chunks_.size(); ++i) {
+    if (!chunks_[i]) {
+      chunks_[i].reset(new Batch<Dtype>());
+      init_batch(top_size, chunks_[i].get());
+    }
+    chunk_free_.push(chunks_[i].get());
+  }
+  read_file_ = 0;
+  read_row_ = 0;
+  chunk_current_ = chunk_free_.pop();
+  LoadHDF5ChunkData(chunk_current_);
+  ResetRows();
+  single_chunk_ = (num_files_ == 1 && read_row_ == 0);
+  if (!single_chunk_) {
+    int device = 0;
+#ifndef CPU_ONLY
+    CUDA_CHECK(cudaGetDevice(&device));
+#endif
+    reader_.reset(new boost::thread(&HDF5DataLayer<Dtype>::ReadChunks, this,
+        device));
+  }
 
   // Reshape blobs.
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  const int top_size = this->layer_param_.top_size();
   vector<int> top_shape;
   for (int i = 0; i < top_size; ++i) {
-    top_shape.resize(hdf_blobs_[i]->num_axes());
+    const Blob<Dtype>* rows = batch_blob(chunk_current_, i);
+    top_shape.resize(rows->num_axes());
     top_shape[0] = batch_size;
     for (int j = 1; j < top_shape.size(); ++j) {
-      top_shape[j] = hdf_blobs_[i]->shape(j);
+      top_shape[j] = rows->shape(j);
     }
     top[i]->Reshape(top_shape);
+    for (int j = 0; j < this->prefetch_.size(); ++j) {
+      Batch<Dtype>* batch = this->prefetch_[j].get();
+      if (i == 0) {
+        init_batch(top_size, batch);
+      }
+      batch_blob(batch, i)->Reshape(top_shape);
+    }
   }
 }
 
@@ -137,49 +245,34 @@ bool HDF5DataLayer<Dtype>::Skip() {
 
 template<typename Dtype>
 void HDF5DataLayer<Dtype>::Next() {
-  if (++current_row_ == hdf_blobs_[0]->shape(0)) {
-    if (num_files_ > 1) {
-      ++current_file_;
-      if (current_file_ == num_files_) {
-        current_file_ = 0;
-        if (this->layer_param_.hdf5_data_param().shuffle()) {
-          std::random_shuffle(file_permutation_.begin(),
-                              file_permutation_.end());
-        }
-        DLOG(INFO) << "Looping around to first file.";
-      }
-      LoadHDF5FileData(
-        hdf_filenames_[file_permutation_[current_file_]].c_str());
-    }
-    current_row_ = 0;
-    if (this->layer_param_.hdf5_data_param().shuffle())
-      std::random_shuffle(data_permutation_.begin(), data_permutation_.end());
+  if (++current_row_ == chunk_current_->data_.shape(0)) {
+    NextChunk();
   }
   offset_++;
 }
 
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top) {
+void HDF5DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
+  const int top_size = this->layer_param_.top_size();
   for (int i = 0; i < batch_size; ++i) {
     while (Skip()) {
       Next();
     }
-    for (int j = 0; j < this->layer_param_.top_size(); ++j) {
-      int data_dim = top[j]->count() / top[j]->shape(0);
+    for (int j = 0; j < top_size; ++j) {
+      const Blob<Dtype>* rows = batch_blob(chunk_current_, j);
+      Blob<Dtype>* top = batch_blob(batch, j);
+      const int data_dim = top->count(1);
+      CHECK_EQ(rows->count(1), data_dim)
+          << "Rows of top " << j << " differ in shape between HDF5 files.";
       caffe_copy(data_dim,
-          &hdf_blobs_[j]->cpu_data()[data_permutation_[current_row_]
-            * data_dim], &top[j]->mutable_cpu_data()[i * data_dim]);
+          &rows->cpu_data()[data_permutation_[current_row_] * data_dim],
+          &top->mutable_cpu_data()[i * data_dim]);
     }
     Next();
   }
 }
 
-#ifdef CPU_ONLY
-STUB_GPU_FORWARD(HDF5DataLayer, Forward);
-#endif
-
 INSTANTIATE_CLASS(HDF5DataLayer);
 REGISTER_LAYER_CLASS(HDF5Data);
 
@@ -0,0 +1,467 @@
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/interprocess/file_mapping.hpp"
+#include "boost/interprocess/mapped_region.hpp"
+#include "boost/thread/recursive_mutex.hpp"
+#include "hdf5.h"
+
+#include "caffe/layers/patch_data_layer.hpp"
+#include "caffe/util/hdf5.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+// Number of random voxels tried before falling back when sampling a center.
+static const int kMaxSampleAttempts = 100;
+
+// Maps the whole file read-only, checking that it holds size bytes from
+// offset.
+static shared_ptr<boost::interprocess::mapped_region> map_file(
+    const string& filename, size_t offset, size_t size) {
+  using boost::interprocess::file_mapping;
+  using boost::interprocess::mapped_region;
+  shared_ptr<mapped_region> region;
+  try {
+    file_mapping file(filename.c_str(), boost::interprocess::read_only);
+    region.reset(new mapped_region(file, boost::interprocess::read_only));
+  } catch (std::exception& e) {
+    LOG(FATAL) << "Failed to map volume " << filename << ": " << e.what();
+  }
+  CHECK_GE(region->get_size(), offset + size) << "Volume " << filename
+      << " is smaller than its shape";
+  return region;
+}
+
+static size_t voxel_size(PatchDataParameter::VoxelType type) {
+  switch (type) {
+  case PatchDataParameter::UINT8:
+    return sizeof(uint8_t);
+  case PatchDataParameter::INT16:
+    return sizeof(int16_t);
+  case PatchDataParameter::UINT16:
+    return sizeof(uint16_t);
+  case PatchDataParameter::INT32:
+    return sizeof(int32_t);
+  case PatchDataParameter::FLOAT:
+    return sizeof(float);
+  case PatchDataParameter::DOUBLE:
+    return sizeof(double);
+  default:
+    LOG(FATAL) << "Unknown voxel type " << type;
+  }
+  return 0;
+}
+
+static PatchDataParameter::VoxelType hdf5_voxel_type(hid_t type_id) {
+  if (H5Tequal(type_id, H5T_NATIVE_UINT8) > 0) {
+    return PatchDataParameter::UINT8;
+  } else if (H5Tequal(type_id, H5T_NATIVE_INT16) > 0) {
+    return PatchDataParameter::INT16;
+  } else if (H5Tequal(type_id, H5T_NATIVE_UINT16) > 0) {
+    return PatchDataParameter::UINT16;
+  } else if (H5Tequal(type_id, H5T_NATIVE_INT32) > 0) {
+    return PatchDataParameter::INT32;
+  } else if (H5Tequal(type_id, H5T_NATIVE_FLOAT) > 0) {
+    return PatchDataParameter::FLOAT;
+  } else if (H5Tequal(type_id, H5T_NATIVE_DOUBLE) > 0) {
+    return PatchDataParameter::DOUBLE;
+  }
+  LOG(FATAL) << "Unsupported HDF5 voxel type";
+  return PatchDataParameter::FLOAT;
+}
+
+template <typename T>
+static inline double voxel(const char* base, size_t index) {
+  return reinterpret_cast<const T*>(base)[index];
+}
+
+static double voxel_at(const char* base, PatchDataParameter::VoxelType type,
+    size_t index) {
+  switch (type) {
+  case PatchDataParameter::UINT8:
+    return voxel<uint8_t>(base, index);
+  case PatchDataParameter::INT16:
+    return voxel<int16_t>(base, index);
+  case PatchDataParameter::UINT16:
+    return voxel<uint16_t>(base, index);
+  case PatchDataParameter::INT32:
+    return voxel<int32_t>(base, index);
+  case PatchDataParameter::FLOAT:
+    return voxel<float>(base, index);
+  case PatchDataParameter::DOUBLE:
+    return voxel<double>(base, index);
+  default:
+    LOG(FATAL) << "Unknown voxel type " << type;
+  }
+  return 0;
+}
+
+// out[i] = (voxel(begin + i) - mean) * scale for i < count.
+template <typename T, typename Dtype>
+static void copy_row(const char* base, size_t begin, int count,
+    Dtype mean, Dtype scale, Dtype* out) {
+  const T* in = reinterpret_cast<const T*>(base) + begin;
+  for (int i = 0; i < count; ++i) {
+    out[i] = (static_cast<Dtype>(in[i]) - mean) * scale;
+  }
+}
+
+template <typename Dtype>
+static void copy_row(const char* base, PatchDataParameter::VoxelType type,
+    size_t begin, int count, Dtype mean, Dtype scale, Dtype* out) {
+  switch (type) {
+  case PatchDataParameter::UINT8:
+    copy_row<uint8_t>(base, begin, count, mean, scale, out);
+    break;
+  case PatchDataParameter::INT16:
+    copy_row<int16_t>(base, begin, count, mean, scale, out);
+    break;
+  case PatchDataParameter::UINT16:
+    copy_row<uint16_t>(base, begin, count, mean, scale, out);
+    break;
+  case PatchDataParameter::INT32:
+    copy_row<int32_t>(base, begin, count, mean, scale, out);
+    break;
+  case PatchDataParameter::FLOAT:
+    copy_row<float>(base, begin, count, mean, scale, out);
+    break;
+  case PatchDataParameter::DOUBLE:
+    copy_row<double>(base, begin, count, mean, scale, out);
+    break;
+  default:
+    LOG(FATAL) << "Unknown voxel type " << type;
+  }
+}
+
+template <typename Dtype>
+PatchDataLayer<Dtype>::~PatchDataLayer<Dtype>() {
+  this->StopInternalThread();
+}
+
+template <typename Dtype>
+void PatchDataLayer<Dtype>::MapRawVolume(const string& data_file,
+    const string& label_file, const vector<int>& shape, Volume* volume) {
+  const PatchDataParameter& param = this->layer_param_.patch_data_param();
+  volume->data_type = param.data_type();
+  volume->label_type = param.label_type();
+  volume->channels = shape[0];
+  const size_t spatial_dim = static_cast<size_t>(shape[1]) * shape[2] *
+      shape[3];
+  volume->data_map = map_file(data_file, 0,
+      volume->channels * spatial_dim * voxel_size(volume->data_type));
+  volume->label_map = map_file(label_file, 0,
+      spatial_dim * voxel_size(volume->label_type));
+  volume->data = static_cast<const char*>(volume->data_map->get_address());
+  volume->label = static_cast<const char*>(volume->label_map->get_address());
+  for (int i = 0; i < 3; ++i) {
+    volume->shape[i] = shape[i + 1];
+  }
+}
+
+template <typename Dtype>
+void PatchDataLayer<Dtype>::MapHDF5Volume(const string& file,
+    Volume* volume) {
+  const PatchDataParameter& param = this->layer_param_.patch_data_param();
+  const string names[2] = { param.data_dataset(), param.label_dataset() };
+  vector<int> shapes[2];
+  haddr_t offsets[2];
+  PatchDataParameter::VoxelType types[2];
+  {
+    boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
+    hid_t file_id = H5Fopen(file.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    CHECK_GE(file_id, 0) << "Failed opening HDF5 file: " << file;
+    for (int i = 0; i < 2; ++i) {
+      hid_t dataset_id = H5Dopen2(file_id, names[i].c_str(), H5P_DEFAULT);
+      CHECK_GE(dataset_id, 0) << "Failed to find HDF5 dataset " << names[i]
+          << " in " << file;
+      hid_t plist_id = H5Dget_create_plist(dataset_id);
+      CHECK_EQ(H5Pget_layout(plist_id), H5D_CONTIGUOUS) << "HDF5 dataset "
+          << names[i] << " must be stored contiguously to be mapped";
+      H5Pclose(plist_id);
+      offsets[i] = H5Dget_offset(dataset_id);
+      CHECK_NE(offsets[i], HADDR_UNDEF) << "HDF5 dataset " << names[i]
+          << " has no storage";
+      hid_t type_id = H5Dget_type(dataset_id);
+      types[i] = hdf5_voxel_type(type_id);
+      H5Tclose(type_id);
+      hid_t space_id = H5Dget_space(dataset_id);
+      vector<hsize_t> dims(H5Sget_simple_extent_ndims(space_id));
+      H5Sget_simple_extent_dims(space_id, dims.data(), NULL);
+      H5Sclose(space_id);
+      H5Dclose(dataset_id);
+      shapes[i].assign(dims.begin(), dims.end());
+    }
+    herr_t status = H5Fclose(file_id);
+    CHECK_GE(status, 0) << "Failed to close HDF5 file: " << file;
+  }
+
+  CHECK_EQ(shapes[1].size(), 3) << "Labels must be D x H x W";
+  CHECK(shapes[0].size() == 3 || shapes[0].size() == 4)
+      << "Images must be C x D x H x W or D x H x W";
+  volume->channels = (shapes[0].size() == 4) ? shapes[0][0] : 1;
+  size_t spatial_dim = 1;
+  for (int i = 0; i < 3; ++i) {
+    CHECK_EQ(shapes[0][shapes[0].size() - 3 + i], shapes[1][i])
+        << "Image and label shapes differ in " << file;
+    volume->shape[i] = shapes[1][i];
+    spatial_dim *= shapes[1][i];
+  }
+  volume->data_type = types[0];
+  volume->label_type = types[1];
+  // Both datasets are read through one mapping of the file.
+  const size_t end = std::max(
+      offsets[0] + volume->channels * spatial_dim * voxel_size(types[0]),
+      offsets[1] + spatial_dim * voxel_size(types[1]));
+  volume->data_map = map_file(file, 0, end);
+  volume->label_map = volume->data_map;
+  volume->data = static_cast<const char*>(volume->data_map->get_address()) +
+      offsets[0];
+  volume->label = static_cast<const char*>(volume->label_map->get_address()) +
+      offsets[1];
+}
+
+template <typename Dtype>
+void PatchDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const PatchDataParameter& param = this->layer_param_.patch_data_param();
+  CHECK_EQ(param.patch_shape_size(), 3)
+      << "patch_shape must give depth, height and width";
+  CHECK(param.label_shape_size() == 0 || param.label_shape_size() == 3)
+      << "label_shape must give depth, height and width";
+  for (int i = 0; i < 3; ++i) {
+    patch_shape_[i] = param.patch_shape(i);
+    label_shape_[i] = param.label_shape_size() ? param.label_shape(i) :
+        patch_shape_[i];
+    CHECK_GT(label_shape_[i], 0);
+    CHECK_LE(label_shape_[i], patch_shape_[i])
+        << "Label patches must fit in the image patches";
+  }
+  CHECK_GE(param.sample_threads(), 1) << "sample_threads must be positive.";
+  CHECK(!this->transform_param_.mirror() &&
+      !this->transform_param_.crop_size() &&
+      !this->transform_param_.has_mean_file()) << this->type()
+      << " only supports scale and mean_value";
+  const unsigned int prefetch_rng_seed = caffe_rng_rand();
+  prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+
+  // Map the volumes listed in the source.
+  std::ifstream infile(param.source().c_str());
+  CHECK(infile.good()) << "Failed to open source file " << param.source();
+  volumes_.clear();
+  string line;
+  while (std::getline(infile, line)) {
+    std::istringstream iss(line);
+    string data_file;
+    if (!(iss >> data_file)) {
+      continue;
+    }
+    Volume volume;
+    if (param.format() == PatchDataParameter::RAW) {
+      string label_file;
+      vector<int> shape(4);
+      CHECK(iss >> label_file >> shape[0] >> shape[1] >> shape[2] >> shape[3])
+          << "Expected a label file and a volume shape after " << data_file;
+      MapRawVolume(data_file, label_file, shape, &volume);
+    } else {
+      MapHDF5Volume(data_file, &volume);
+    }
+    volumes_.push_back(volume);
+  }
+  CHECK(!volumes_.empty()) << "No volumes listed in " << param.source();
+
+  // Find the foreground of every volume.
+  const double background = param.background_label();
+  fg_volumes_.clear();
+  for (int v = 0; v < volumes_.size(); ++v) {
+    Volume& volume = volumes_[v];
+    CHECK_EQ(volume.channels, volumes_[0].channels)
+        << "All volumes must have the same number of channels";
+    for (int i = 0; i < 3; ++i) {
+      volume.fg_begin[i] = volume.shape[i];
+      volume.fg_end[i] = 0;
+    }
+    size_t index = 0;
+    for (int z = 0; z < volume.shape[0]; ++z) {
+      for (int y = 0; y < volume.shape[1]; ++y) {
+        for (int x = 0; x < volume.shape[2]; ++x, ++index) {
+          if (voxel_at(volume.label, volume.label_type, index) != background) {
+            const int position[3] = { z, y, x };
+            for (int i = 0; i < 3; ++i) {
+              volume.fg_begin[i] = std::min(volume.fg_begin[i], position[i]);
+              volume.fg_end[i] = std::max(volume.fg_end[i], position[i] + 1);
+            }
+          }
+        }
+      }
+    }
+    volume.has_fg = volume.fg_end[0] > 0;
+    if (volume.has_fg) {
+      fg_volumes_.push_back(v);
+    }
+  }
+  const int channels = volumes_[0].channels;
+  LOG(INFO) << "Mapped " << volumes_.size() << " volumes, "
+      << fg_volumes_.size() << " of them with foreground";
+
+  mean_values_.clear();
+  for (int c = 0; c < this->transform_param_.mean_value_size(); ++c) {
+    mean_values_.push_back(this->transform_param_.mean_value(c));
+  }
+  CHECK(mean_values_.size() <= 1 || mean_values_.size() == channels) <<
+      "Specify either 1 mean_value or as many as channels: " << channels;
+  mean_values_.resize(channels, mean_values_.empty() ? 0 : mean_values_[0]);
+
+  // Reshape the tops and the prefetch batches.
+  const int batch_size = param.batch_size();
+  vector<int> data_shape(5), label_shape(5);
+  data_shape[0] = label_shape[0] = batch_size;
+  data_shape[1] = channels;
+  label_shape[1] = 1;
+  for (int i = 0; i < 3; ++i) {
+    data_shape[i + 2] = patch_shape_[i];
+    label_shape[i + 2] = label_shape_[i];
+  }
+  top[0]->Reshape(data_shape);
+  top[1]->Reshape(label_shape);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.Reshape(data_shape);
+    this->prefetch_[i]->label_.Reshape(label_shape);
+  }
+  LOG(INFO) << "output data size: " << top[0]->shape_string();
+}
+
+template <typename Dtype>
+unsigned int PatchDataLayer<Dtype>::PrefetchRand() {
+  CHECK(prefetch_rng_);
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  return (*prefetch_rng)();
+}
+
+template <typename Dtype>
+void PatchDataLayer<Dtype>::SampleCenter(const Volume& volume,
+    bool foreground, int* center) {
+  const double background =
+      this->layer_param_.patch_data_param().background_label();
+  const int* begin = foreground ? volume.fg_begin : NULL;
+  const int* end = foreground ? volume.fg_end : volume.shape;
+  // Rejection sampling, within the bounding box of the foreground for
+  // foreground voxels.
+  for (int attempt = 0; attempt < kMaxSampleAttempts; ++attempt) {
+    for (int i = 0; i < 3; ++i) {
+      const int offset = begin ? begin[i] : 0;
+      center[i] = offset + PrefetchRand() % (end[i] - offset);
+    }
+    const size_t index = (static_cast<size_t>(center[0]) * volume.shape[1] +
+        center[1]) * volume.shape[2] + center[2];
+    const double label = voxel_at(volume.label, volume.label_type, index);
+    if ((label != background) == foreground) {
+      return;
+    }
+  }
+  if (!foreground) {
+    // Nearly all foreground: keep the last uniform pick.
+    return;
+  }
+  // Sparse foreground: take the first foreground voxel of the box.
+  for (center[0] = begin[0]; center[0] < end[0]; ++center[0]) {
+    for (center[1] = begin[1]; center[1] < end[1]; ++center[1]) {
+      for (center[2] = begin[2]; center[2] < end[2]; ++center[2]) {
+        const size_t index = (static_cast<size_t>(center[0]) *
+            volume.shape[1] + center[1]) * volume.shape[2] + center[2];
+        if (voxel_at(volume.label, volume.label_type, index) != background) {
+          return;
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void PatchDataLayer<Dtype>::CopyPatch(const Volume& volume, bool label,
+    const int* origin, const int* shape, Dtype* patch) {
+  const int channels = label ? 1 : volume.channels;
+  const char* base = label ? volume.label : volume.data;
+  const PatchDataParameter::VoxelType type =
+      label ? volume.label_type : volume.data_type;
+  const Dtype scale = label ? Dtype(1) : Dtype(this->transform_param_.scale());
+  const Dtype pad = label ?
+      Dtype(this->layer_param_.patch_data_param().background_label()) :
+      Dtype(0);
+  // The range [begin, end) of the patch inside the volume along each axis.
+  int begin[3], end[3];
+  bool inside = true;
+  for (int i = 0; i < 3; ++i) {
+    begin[i] = std::max(0, -origin[i]);
+    end[i] = std::max(begin[i],
+        std::min(shape[i], volume.shape[i] - origin[i]));
+    inside = inside && begin[i] == 0 && end[i] == shape[i];
+  }
+  const int patch_dim = shape[0] * shape[1] * shape[2];
+  if (!inside) {
+    caffe_set(channels * patch_dim, pad, patch);
+  }
+  for (int c = 0; c < channels; ++c) {
+    const Dtype mean = label ? Dtype(0) : mean_values_[c];
+    for (int z = begin[0]; z < end[0]; ++z) {
+      for (int y = begin[1]; y < end[1]; ++y) {
+        const size_t index = ((static_cast<size_t>(c) * volume.shape[0] +
+            origin[0] + z) * volume.shape[1] + origin[1] + y) *
+            volume.shape[2] + origin[2] + begin[2];
+        copy_row(base, type, index, end[2] - begin[2], mean, scale,
+            patch + c * patch_dim + (z * shape[1] + y) * shape[2] + begin[2]);
+      }
+    }
+  }
+}
+
+// This function is called on prefetch thread
+template <typename Dtype>
+void PatchDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
+  const PatchDataParameter& param = this->layer_param_.patch_data_param();
+  const int batch_size = param.batch_size();
+  const int num_fg = fg_volumes_.empty() ? 0 :
+      static_cast<int>(static_cast<float>(batch_size) * param.fg_fraction());
+  // Draw the patches first, so that they do not depend on sample_threads.
+  vector<int> volume_ids(batch_size);
+  vector<int> origins(3 * batch_size);
+  for (int n = 0; n < batch_size; ++n) {
+    const bool foreground = n < num_fg;
+    volume_ids[n] = foreground ?
+        fg_volumes_[PrefetchRand() % fg_volumes_.size()] :
+        PrefetchRand() % volumes_.size();
+    int* origin = &origins[3 * n];
+    SampleCenter(volumes_[volume_ids[n]], foreground, origin);
+    for (int i = 0; i < 3; ++i) {
+      origin[i] -= patch_shape_[i] / 2;
+    }
+  }
+  Dtype* top_data = batch->data_.mutable_cpu_data();
+  Dtype* top_label = batch->label_.mutable_cpu_data();
+  const int data_dim = batch->data_.count(1);
+  const int label_dim = batch->label_.count(1);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(param.sample_threads())
+#endif
+  for (int n = 0; n < batch_size; ++n) {
+    const Volume& volume = volumes_[volume_ids[n]];
+    const int* origin = &origins[3 * n];
+    int label_origin[3];
+    for (int i = 0; i < 3; ++i) {
+      label_origin[i] = origin[i] + (patch_shape_[i] - label_shape_[i]) / 2;
+    }
+    CopyPatch(volume, false, origin, patch_shape_, top_data + n * data_dim);
+    CopyPatch(volume, true, label_origin, label_shape_,
+        top_label + n * label_dim);
+  }
+}
+
+INSTANTIATE_CLASS(PatchDataLayer);
+REGISTER_LAYER_CLASS(PatchData);
+
+}  // namespace caffe
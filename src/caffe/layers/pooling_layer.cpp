@@ -10,14 +10,44 @@ namespace caffe {
 using std::min;
 using std::max;
 
+// Fills the right-aligned (depth, height, width) entries of values for the
+// spatial axes from a setting given once for all axes or once per axis.
+static void pool_param_nd(
+    const google::protobuf::RepeatedField<google::protobuf::uint32>& param,
+    const int num_spatial_axes, vector<int>* values) {
+  CHECK(param.size() == 1 || param.size() == num_spatial_axes)
+      << "_nd pooling settings must be given once or once per spatial axis "
+      << "(" << num_spatial_axes << "), not " << param.size() << " times.";
+  for (int i = 0; i < num_spatial_axes; ++i) {
+    (*values)[3 - num_spatial_axes + i] =
+        param.Get((param.size() == 1) ? 0 : i);
+  }
+}
+
 template <typename Dtype>
 void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   PoolingParameter pool_param = this->layer_param_.pooling_param();
+  num_spatial_axes_ = bottom[0]->num_axes() - 2;
+  CHECK_GE(num_spatial_axes_, 1) << "Input must have (num, channels) and at "
+      << "least one spatial axis.";
+  CHECK_LE(num_spatial_axes_, 3) << "Pooling supports up to three spatial "
+      << "axes (num, channels, depth, height, width).";
+  if (num_spatial_axes_ != 2) {
+    CHECK(!(pool_param.has_kernel_h() || pool_param.has_kernel_w() ||
+        pool_param.has_pad_h() || pool_param.has_pad_w() ||
+        pool_param.has_stride_h() || pool_param.has_stride_w()))
+        << "_h and _w settings are only for 2-D pooling; use the _nd ones.";
+  }
   if (pool_param.global_pooling()) {
     CHECK(!(pool_param.has_kernel_size() ||
-      pool_param.has_kernel_h() || pool_param.has_kernel_w()))
+      pool_param.has_kernel_h() || pool_param.has_kernel_w() ||
+      pool_param.kernel_nd_size() > 0))
       << "With Global_pooling: true Filter size cannot specified";
+  } else if (pool_param.kernel_nd_size() > 0) {
+    CHECK(!(pool_param.has_kernel_size() ||
+      pool_param.has_kernel_h() || pool_param.has_kernel_w()))
+      << "Filter size is kernel_nd OR kernel_size OR kernel_h and kernel_w";
   } else {
     CHECK(!pool_param.has_kernel_size() !=
       !(pool_param.has_kernel_h() && pool_param.has_kernel_w()))
@@ -30,95 +60,343 @@ void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       && pool_param.has_pad_w())
       || (!pool_param.has_pad_h() && !pool_param.has_pad_w()))
       << "pad is pad OR pad_h and pad_w are required.";
+  CHECK(pool_param.pad_nd_size() == 0 || !(pool_param.has_pad() ||
+      pool_param.has_pad_h())) << "pad is pad_nd OR pad OR pad_h and pad_w.";
   CHECK((!pool_param.has_stride() && pool_param.has_stride_h()
       && pool_param.has_stride_w())
       || (!pool_param.has_stride_h() && !pool_param.has_stride_w()))
       << "Stride is stride OR stride_h and stride_w are required.";
+  CHECK(pool_param.stride_nd_size() == 0 || !(pool_param.has_stride() ||
+      pool_param.has_stride_h()))
+      << "Stride is stride_nd OR stride OR stride_h and stride_w.";
   global_pooling_ = pool_param.global_pooling();
+  kernel_nd_.assign(3, 1);
+  stride_nd_.assign(3, 1);
+  pad_nd_.assign(3, 0);
+  const int first_axis = 3 - num_spatial_axes_;
   if (global_pooling_) {
-    kernel_h_ = bottom[0]->height();
-    kernel_w_ = bottom[0]->width();
-  } else {
-    if (pool_param.has_kernel_size()) {
-      kernel_h_ = kernel_w_ = pool_param.kernel_size();
-    } else {
-      kernel_h_ = pool_param.kernel_h();
-      kernel_w_ = pool_param.kernel_w();
+    for (int i = 0; i < num_spatial_axes_; ++i) {
+      kernel_nd_[first_axis + i] = bottom[0]->shape(2 + i);
     }
+  } else if (pool_param.kernel_nd_size() > 0) {
+    pool_param_nd(pool_param.kernel_nd(), num_spatial_axes_, &kernel_nd_);
+  } else if (pool_param.has_kernel_size()) {
+    std::fill(kernel_nd_.begin() + first_axis, kernel_nd_.end(),
+        pool_param.kernel_size());
+  } else {
+    kernel_nd_[1] = pool_param.kernel_h();
+    kernel_nd_[2] = pool_param.kernel_w();
   }
-  CHECK_GT(kernel_h_, 0) << "Filter dimensions cannot be zero.";
-  CHECK_GT(kernel_w_, 0) << "Filter dimensions cannot be zero.";
-  if (!pool_param.has_pad_h()) {
-    pad_h_ = pad_w_ = pool_param.pad();
+  for (int i = first_axis; i < 3; ++i) {
+    CHECK_GT(kernel_nd_[i], 0) << "Filter dimensions cannot be zero.";
+  }
+  if (pool_param.pad_nd_size() > 0) {
+    pool_param_nd(pool_param.pad_nd(), num_spatial_axes_, &pad_nd_);
+  } else if (!pool_param.has_pad_h()) {
+    std::fill(pad_nd_.begin() + first_axis, pad_nd_.end(), pool_param.pad());
   } else {
-    pad_h_ = pool_param.pad_h();
-    pad_w_ = pool_param.pad_w();
+    pad_nd_[1] = pool_param.pad_h();
+    pad_nd_[2] = pool_param.pad_w();
   }
-  if (!pool_param.has_stride_h()) {
-    stride_h_ = stride_w_ = pool_param.stride();
+  if (pool_param.stride_nd_size() > 0) {
+    pool_param_nd(pool_param.stride_nd(), num_spatial_axes_, &stride_nd_);
+  } else if (!pool_param.has_stride_h()) {
+    std::fill(stride_nd_.begin() + first_axis, stride_nd_.end(),
+        pool_param.stride());
   } else {
-    stride_h_ = pool_param.stride_h();
-    stride_w_ = pool_param.stride_w();
+    stride_nd_[1] = pool_param.stride_h();
+    stride_nd_[2] = pool_param.stride_w();
   }
-  if (global_pooling_) {
-    CHECK(pad_h_ == 0 && pad_w_ == 0 && stride_h_ == 1 && stride_w_ == 1)
-      << "With Global_pooling: true; only pad = 0 and stride = 1";
+  bool has_pad = false;
+  for (int i = first_axis; i < 3; ++i) {
+    CHECK_GT(stride_nd_[i], 0) << "Stride cannot be zero.";
+    if (global_pooling_) {
+      CHECK(pad_nd_[i] == 0 && stride_nd_[i] == 1)
+        << "With Global_pooling: true; only pad = 0 and stride = 1";
+    }
+    has_pad |= pad_nd_[i] != 0;
   }
-  if (pad_h_ != 0 || pad_w_ != 0) {
+  if (has_pad) {
     CHECK(this->layer_param_.pooling_param().pool()
         == PoolingParameter_PoolMethod_AVE
         || this->layer_param_.pooling_param().pool()
         == PoolingParameter_PoolMethod_MAX)
         << "Padding implemented only for average and max pooling.";
-    CHECK_LT(pad_h_, kernel_h_);
-    CHECK_LT(pad_w_, kernel_w_);
+    for (int i = first_axis; i < 3; ++i) {
+      CHECK_LT(pad_nd_[i], kernel_nd_[i]);
+    }
   }
+  kernel_h_ = kernel_nd_[1];
+  kernel_w_ = kernel_nd_[2];
+  pad_h_ = pad_nd_[1];
+  pad_w_ = pad_nd_[2];
+  stride_h_ = stride_nd_[1];
+  stride_w_ = stride_nd_[2];
 }
 
 template <typename Dtype>
 void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  CHECK_EQ(4, bottom[0]->num_axes()) << "Input must have 4 axes, "
-      << "corresponding to (num, channels, height, width)";
-  channels_ = bottom[0]->channels();
-  height_ = bottom[0]->height();
-  width_ = bottom[0]->width();
-  if (global_pooling_) {
-    kernel_h_ = bottom[0]->height();
-    kernel_w_ = bottom[0]->width();
-  }
-  pooled_height_ = static_cast<int>(ceil(static_cast<float>(
-      height_ + 2 * pad_h_ - kernel_h_) / stride_h_)) + 1;
-  pooled_width_ = static_cast<int>(ceil(static_cast<float>(
-      width_ + 2 * pad_w_ - kernel_w_) / stride_w_)) + 1;
-  if (pad_h_ || pad_w_) {
-    // If we have padding, ensure that the last pooling starts strictly
-    // inside the image (instead of at the padding); otherwise clip the last.
-    if ((pooled_height_ - 1) * stride_h_ >= height_ + pad_h_) {
-      --pooled_height_;
+  CHECK_EQ(num_spatial_axes_ + 2, bottom[0]->num_axes())
+      << "Input number of axes cannot change after setup.";
+  channels_ = bottom[0]->shape(1);
+  input_nd_.assign(3, 1);
+  pooled_nd_.assign(3, 1);
+  vector<int> top_shape(bottom[0]->shape());
+  for (int i = 0; i < num_spatial_axes_; ++i) {
+    const int axis = 3 - num_spatial_axes_ + i;
+    const int input = bottom[0]->shape(2 + i);
+    if (global_pooling_) {
+      kernel_nd_[axis] = input;
     }
-    if ((pooled_width_ - 1) * stride_w_ >= width_ + pad_w_) {
-      --pooled_width_;
+    const int kernel = kernel_nd_[axis];
+    const int stride = stride_nd_[axis];
+    const int pad = pad_nd_[axis];
+    int pooled = static_cast<int>(ceil(static_cast<float>(
+        input + 2 * pad - kernel) / stride)) + 1;
+    if (pad) {
+      // If we have padding, ensure that the last pooling starts strictly
+      // inside the image (instead of at the padding); otherwise clip the last.
+      if ((pooled - 1) * stride >= input + pad) {
+        --pooled;
+      }
+      CHECK_LT((pooled - 1) * stride, input + pad);
     }
-    CHECK_LT((pooled_height_ - 1) * stride_h_, height_ + pad_h_);
-    CHECK_LT((pooled_width_ - 1) * stride_w_, width_ + pad_w_);
+    input_nd_[axis] = input;
+    pooled_nd_[axis] = pooled;
+    top_shape[2 + i] = pooled;
   }
-  top[0]->Reshape(bottom[0]->num(), channels_, pooled_height_,
-      pooled_width_);
+  kernel_h_ = kernel_nd_[1];
+  kernel_w_ = kernel_nd_[2];
+  height_ = input_nd_[1];
+  width_ = input_nd_[2];
+  pooled_height_ = pooled_nd_[1];
+  pooled_width_ = pooled_nd_[2];
+  top[0]->Reshape(top_shape);
   if (top.size() > 1) {
     top[1]->ReshapeLike(*top[0]);
   }
   // If max pooling, we will initialize the vector index part.
   if (this->layer_param_.pooling_param().pool() ==
       PoolingParameter_PoolMethod_MAX && top.size() == 1) {
-    max_idx_.Reshape(bottom[0]->num(), channels_, pooled_height_,
-        pooled_width_);
+    max_idx_.Reshape(top_shape);
   }
   // If stochastic pooling, we will initialize the random index part.
   if (this->layer_param_.pooling_param().pool() ==
       PoolingParameter_PoolMethod_STOCHASTIC) {
-    rand_idx_.Reshape(bottom[0]->num(), channels_, pooled_height_,
-      pooled_width_);
+    rand_idx_.Reshape(top_shape);
+  }
+}
+
+template <typename Dtype>
+int PoolingLayer<Dtype>::PoolWindowND(int index, int* start, int* end) const {
+  int pool_size = 1;
+  for (int i = 2; i >= 0; --i) {
+    const int p = index % pooled_nd_[i];
+    index /= pooled_nd_[i];
+    start[i] = p * stride_nd_[i] - pad_nd_[i];
+    end[i] = min(start[i] + kernel_nd_[i], input_nd_[i] + pad_nd_[i]);
+    pool_size *= end[i] - start[i];
+    start[i] = max(start[i], 0);
+    end[i] = min(end[i], input_nd_[i]);
+  }
+  return pool_size;
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::Forward_cpu_nd(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  const int top_count = top[0]->count();
+  const int slices = bottom[0]->shape(0) * channels_;
+  const int input_dim = input_nd_[0] * input_nd_[1] * input_nd_[2];
+  const int pooled_dim = pooled_nd_[0] * pooled_nd_[1] * pooled_nd_[2];
+  const int height = input_nd_[1];
+  const int width = input_nd_[2];
+  int start[3], end[3];
+  // Masks and random indices address the bottom within its (n, c) slice.
+  switch (this->layer_param_.pooling_param().pool()) {
+  case PoolingParameter_PoolMethod_MAX: {
+    const bool use_top_mask = top.size() > 1;
+    Dtype* top_mask = use_top_mask ? top[1]->mutable_cpu_data() : NULL;
+    int* mask = use_top_mask ? NULL : max_idx_.mutable_cpu_data();
+    for (int s = 0; s < slices; ++s) {
+      const Dtype* slice_data = bottom_data + s * input_dim;
+      for (int p = 0; p < pooled_dim; ++p) {
+        PoolWindowND(p, start, end);
+        Dtype max_value = -FLT_MAX;
+        int max_index = -1;
+        for (int d = start[0]; d < end[0]; ++d) {
+          for (int h = start[1]; h < end[1]; ++h) {
+            const int row = (d * height + h) * width;
+            for (int w = start[2]; w < end[2]; ++w) {
+              if (slice_data[row + w] > max_value) {
+                max_value = slice_data[row + w];
+                max_index = row + w;
+              }
+            }
+          }
+        }
+        const int index = s * pooled_dim + p;
+        top_data[index] = max_value;
+        if (use_top_mask) {
+          top_mask[index] = static_cast<Dtype>(max_index);
+        } else {
+          mask[index] = max_index;
+        }
+      }
+    }
+    break;
+  }
+  case PoolingParameter_PoolMethod_AVE:
+    for (int s = 0; s < slices; ++s) {
+      const Dtype* slice_data = bottom_data + s * input_dim;
+      for (int p = 0; p < pooled_dim; ++p) {
+        const int pool_size = PoolWindowND(p, start, end);
+        Dtype sum = 0;
+        for (int d = start[0]; d < end[0]; ++d) {
+          for (int h = start[1]; h < end[1]; ++h) {
+            const Dtype* row = slice_data + (d * height + h) * width;
+            for (int w = start[2]; w < end[2]; ++w) {
+              sum += row[w];
+            }
+          }
+        }
+        top_data[s * pooled_dim + p] = sum / pool_size;
+      }
+    }
+    break;
+  case PoolingParameter_PoolMethod_STOCHASTIC:
+    if (this->phase_ == TRAIN) {
+      // Sample an element of each window with probability proportional to
+      // its (non-negative) activation.
+      Dtype* rand_idx = rand_idx_.mutable_cpu_data();
+      caffe_rng_uniform(top_count, Dtype(0), Dtype(1), rand_idx);
+      for (int s = 0; s < slices; ++s) {
+        const Dtype* slice_data = bottom_data + s * input_dim;
+        for (int p = 0; p < pooled_dim; ++p) {
+          PoolWindowND(p, start, end);
+          Dtype cumsum = 0;
+          for (int d = start[0]; d < end[0]; ++d) {
+            for (int h = start[1]; h < end[1]; ++h) {
+              const Dtype* row = slice_data + (d * height + h) * width;
+              for (int w = start[2]; w < end[2]; ++w) {
+                cumsum += row[w];
+              }
+            }
+          }
+          const int index = s * pooled_dim + p;
+          const Dtype thres = rand_idx[index] * cumsum;
+          // Fall back to the last element when rounding keeps the running
+          // sum below the threshold.
+          int sample =
+              ((end[0] - 1) * height + end[1] - 1) * width + end[2] - 1;
+          bool found = false;
+          cumsum = 0;
+          for (int d = start[0]; d < end[0] && !found; ++d) {
+            for (int h = start[1]; h < end[1] && !found; ++h) {
+              const int row = (d * height + h) * width;
+              for (int w = start[2]; w < end[2]; ++w) {
+                cumsum += slice_data[row + w];
+                if (cumsum >= thres) {
+                  sample = row + w;
+                  found = true;
+                  break;
+                }
+              }
+            }
+          }
+          rand_idx[index] = static_cast<Dtype>(sample);
+          top_data[index] = slice_data[sample];
+        }
+      }
+    } else {
+      // At test time, weight each activation by its probability.
+      for (int s = 0; s < slices; ++s) {
+        const Dtype* slice_data = bottom_data + s * input_dim;
+        for (int p = 0; p < pooled_dim; ++p) {
+          PoolWindowND(p, start, end);
+          Dtype cumsum = 0;
+          Dtype cumvalues = 0;
+          for (int d = start[0]; d < end[0]; ++d) {
+            for (int h = start[1]; h < end[1]; ++h) {
+              const Dtype* row = slice_data + (d * height + h) * width;
+              for (int w = start[2]; w < end[2]; ++w) {
+                cumsum += row[w];
+                cumvalues += row[w] * row[w];
+              }
+            }
+          }
+          top_data[s * pooled_dim + p] =
+              (cumsum > 0.) ? cumvalues / cumsum : 0.;
+        }
+      }
+    }
+    break;
+  default:
+    LOG(FATAL) << "Unknown pooling method.";
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::Backward_cpu_nd(const vector<Blob<Dtype>*>& top,
+      const vector<Blob<Dtype>*>& bottom) {
+  const Dtype* top_diff = top[0]->cpu_diff();
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
+  const int slices = bottom[0]->shape(0) * channels_;
+  const int input_dim = input_nd_[0] * input_nd_[1] * input_nd_[2];
+  const int pooled_dim = pooled_nd_[0] * pooled_nd_[1] * pooled_nd_[2];
+  const int height = input_nd_[1];
+  const int width = input_nd_[2];
+  int start[3], end[3];
+  switch (this->layer_param_.pooling_param().pool()) {
+  case PoolingParameter_PoolMethod_MAX: {
+    const bool use_top_mask = top.size() > 1;
+    const Dtype* top_mask = use_top_mask ? top[1]->cpu_data() : NULL;
+    const int* mask = use_top_mask ? NULL : max_idx_.cpu_data();
+    for (int s = 0; s < slices; ++s) {
+      Dtype* slice_diff = bottom_diff + s * input_dim;
+      for (int p = 0; p < pooled_dim; ++p) {
+        const int index = s * pooled_dim + p;
+        const int bottom_index = use_top_mask ?
+            static_cast<int>(top_mask[index]) : mask[index];
+        slice_diff[bottom_index] += top_diff[index];
+      }
+    }
+    break;
+  }
+  case PoolingParameter_PoolMethod_AVE:
+    for (int s = 0; s < slices; ++s) {
+      Dtype* slice_diff = bottom_diff + s * input_dim;
+      for (int p = 0; p < pooled_dim; ++p) {
+        const int pool_size = PoolWindowND(p, start, end);
+        const Dtype diff = top_diff[s * pooled_dim + p] / pool_size;
+        for (int d = start[0]; d < end[0]; ++d) {
+          for (int h = start[1]; h < end[1]; ++h) {
+            Dtype* row = slice_diff + (d * height + h) * width;
+            for (int w = start[2]; w < end[2]; ++w) {
+              row[w] += diff;
+            }
+          }
+        }
+      }
+    }
+    break;
+  case PoolingParameter_PoolMethod_STOCHASTIC: {
+    const Dtype* rand_idx = rand_idx_.cpu_data();
+    for (int s = 0; s < slices; ++s) {
+      Dtype* slice_diff = bottom_diff + s * input_dim;
+      for (int p = 0; p < pooled_dim; ++p) {
+        const int index = s * pooled_dim + p;
+        slice_diff[static_cast<int>(rand_idx[index])] += top_diff[index];
+      }
+    }
+    break;
+  }
+  default:
+    LOG(FATAL) << "Unknown pooling method.";
   }
 }
 
@@ -127,6 +405,10 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  if (num_spatial_axes_ != 2) {
+    Forward_cpu_nd(bottom, top);
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int top_count = top[0]->count();
@@ -219,7 +501,7 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     }
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
-    NOT_IMPLEMENTED;
+    Forward_cpu_nd(bottom, top);
     break;
   default:
     LOG(FATAL) << "Unknown pooling method.";
@@ -232,6 +514,10 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   if (!propagate_down[0]) {
     return;
   }
+  if (num_spatial_axes_ != 2) {
+    Backward_cpu_nd(top, bottom);
+    return;
+  }
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
   // Different pooling methods. We explicitly do the switch outside the for
@@ -299,7 +585,7 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     }
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
-    NOT_IMPLEMENTED;
+    Backward_cpu_nd(top, bottom);
     break;
   default:
     LOG(FATAL) << "Unknown pooling method.";
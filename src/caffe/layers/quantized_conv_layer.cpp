@@ -0,0 +1,76 @@
+#include <vector>
+
+#include "caffe/layers/quantized_conv_layer.hpp"
+#include "caffe/util/quantize.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void QuantizedConvolutionLayer<Dtype>::quantize_weights() {
+  const Blob<Dtype>& weights = *this->blobs_[0];
+  const int num_output = weights.shape(0);
+  const int weight_dim = weights.count(1);
+  weight_q_.resize(weights.count());
+  weight_scale_.resize(num_output);
+  for (int c = 0; c < num_output; ++c) {
+    const Dtype* channel = weights.cpu_data() + c * weight_dim;
+    weight_scale_[c] = caffe_cpu_amax(weight_dim, channel) / 127;
+    caffe_cpu_quantize(weight_dim, channel, weight_scale_[c],
+        &weight_q_[c * weight_dim]);
+  }
+  weights_quantized_ = true;
+}
+
+template <typename Dtype>
+void QuantizedConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (!weights_quantized_) {
+    quantize_weights();
+  }
+  const Dtype input_scale =
+      this->layer_param_.quantization_param().input_range() / 127;
+  // Per group: weights M x K times columns K x N.
+  int out_spatial_dim = 1;
+  for (int i = 0; i < this->num_spatial_axes_; ++i) {
+    out_spatial_dim *= this->output_shape_[i];
+  }
+  const int M = this->num_output_ / this->group_;
+  const int K = this->blobs_[0]->count(1);
+  const int N = out_spatial_dim;
+  input_q_.resize(this->bottom_dim_);
+  col_q_.resize(this->is_1x1_ ? 0 : this->group_ * K * N);
+  output_q_.resize(this->num_output_ * N);
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    for (int n = 0; n < this->num_; ++n) {
+      caffe_cpu_quantize(this->bottom_dim_, bottom_data + n * this->bottom_dim_,
+          input_scale, &input_q_[0]);
+      const int8_t* col = &input_q_[0];
+      if (!this->is_1x1_) {
+        this->conv_im2col_cpu(&input_q_[0], &col_q_[0]);
+        col = &col_q_[0];
+      }
+      for (int g = 0; g < this->group_; ++g) {
+        caffe_cpu_gemm_int8(M, N, K, &weight_q_[g * M * K], col + g * K * N,
+            &output_q_[g * M * N]);
+      }
+      Dtype* output = top_data + n * this->top_dim_;
+      for (int c = 0; c < this->num_output_; ++c) {
+        const Dtype scale = input_scale * weight_scale_[c];
+        const Dtype offset = bias ? bias[c] : Dtype(0);
+        for (int j = 0; j < N; ++j) {
+          output[c * N + j] = scale * output_q_[c * N + j] + offset;
+        }
+      }
+      if (this->fused_relu_) {
+        this->forward_cpu_relu(output);
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(QuantizedConvolutionLayer);
+
+}  // namespace caffe
@@ -0,0 +1,57 @@
+#include <vector>
+
+#include "caffe/layers/quantized_inner_product_layer.hpp"
+#include "caffe/util/quantize.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void QuantizedInnerProductLayer<Dtype>::quantize_weights() {
+  const Dtype* weights = this->blobs_[0]->cpu_data();
+  // Gather each output's weights (a row, or a column if transpose_).
+  vector<Dtype> output_weights(this->K_);
+  vector<int8_t> output_weights_q(this->K_);
+  weight_q_.resize(this->K_ * this->N_);
+  weight_scale_.resize(this->N_);
+  for (int n = 0; n < this->N_; ++n) {
+    for (int k = 0; k < this->K_; ++k) {
+      output_weights[k] = this->transpose_ ?
+          weights[k * this->N_ + n] : weights[n * this->K_ + k];
+    }
+    weight_scale_[n] = caffe_cpu_amax(this->K_, &output_weights[0]) / 127;
+    caffe_cpu_quantize(this->K_, &output_weights[0], weight_scale_[n],
+        &output_weights_q[0]);
+    for (int k = 0; k < this->K_; ++k) {
+      weight_q_[k * this->N_ + n] = output_weights_q[k];
+    }
+  }
+  weights_quantized_ = true;
+}
+
+template <typename Dtype>
+void QuantizedInnerProductLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (!weights_quantized_) {
+    quantize_weights();
+  }
+  const Dtype input_scale =
+      this->layer_param_.quantization_param().input_range() / 127;
+  input_q_.resize(this->M_ * this->K_);
+  output_q_.resize(this->M_ * this->N_);
+  caffe_cpu_quantize(this->M_ * this->K_, bottom[0]->cpu_data(), input_scale,
+      &input_q_[0]);
+  caffe_cpu_gemm_int8(this->M_, this->N_, this->K_, &input_q_[0],
+      &weight_q_[0], &output_q_[0]);
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  for (int m = 0; m < this->M_; ++m) {
+    for (int n = 0; n < this->N_; ++n) {
+      top_data[m * this->N_ + n] = input_scale * weight_scale_[n] *
+          output_q_[m * this->N_ + n] + (bias ? bias[n] : Dtype(0));
+    }
+  }
+}
+
+INSTANTIATE_CLASS(QuantizedInnerProductLayer);
+
+}  // namespace caffe
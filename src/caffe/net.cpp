@@ -9,6 +9,9 @@
 // #include <chrono>
 // #include <iostream>
 
+#include "boost/interprocess/file_mapping.hpp"
+#include "boost/interprocess/mapped_region.hpp"
+#include "boost/thread/recursive_mutex.hpp"
 #include "hdf5.h"
 
 #include "caffe/common.hpp"
@@ -16,6 +19,7 @@
 #include "caffe/net.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/fold_layers.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -57,6 +61,15 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   // the current NetState.
   NetParameter filtered_param;
   FilterNet(in_param, &filtered_param);
+  if (filtered_param.fuse_elementwise()) {
+    if (phase_ == TEST) {
+      const NetParameter unfused_param(filtered_param);
+      FuseElementwiseLayers(unfused_param, &filtered_param);
+    } else {
+      LOG_IF(INFO, Caffe::root_solver()) << "fuse_elementwise only applies "
+          << "to the TEST phase; fused layers have no backward.";
+    }
+  }
   LOG_IF(INFO, Caffe::root_solver())
       << "Initializing net from parameters: " << std::endl
       << filtered_param.DebugString();
@@ -80,6 +93,11 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     if (!param.layer(layer_id).has_phase()) {
       param.mutable_layer(layer_id)->set_phase(phase_);
     }
+    if (param.share_workspace() && param.layer(layer_id).has_convolution_param()
+        && !param.layer(layer_id).convolution_param().has_shared_workspace()) {
+      param.mutable_layer(layer_id)->mutable_convolution_param()
+          ->set_shared_workspace(true);
+    }
     // Setup layer.
     const LayerParameter& layer_param = param.layer(layer_id);
     if (layer_param.propagate_down_size() > 0) {
@@ -271,6 +289,17 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   for(size_t blob_id = 0; blob_id < net_output_blobs_.size(); ++blob_id) {
      net_output_blobs_[blob_id]->prevent_mem_release();
   }
+  if (phase_ == TRAIN) {
+    PlanCheckpoints();
+  }
+  if (param.share_activation_memory()) {
+    if (phase_ == TEST) {
+      PlanActivationMemory();
+    } else {
+      LOG_IF(INFO, Caffe::root_solver()) << "share_activation_memory only "
+          << "applies to the TEST phase; backward needs every activation.";
+    }
+  }
 
   //timing data
   // for(int i = 0; i < param.layer_size(); ++i) {
@@ -281,6 +310,292 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   LOG_IF(INFO, Caffe::root_solver()) << "Network initialization done.";
 }
 
+// Representative of the alias group of blob_id, for Net::BlobAliases.
+static int find_alias(vector<int>* alias, int blob_id) {
+  while ((*alias)[blob_id] != blob_id) {
+    (*alias)[blob_id] = (*alias)[(*alias)[blob_id]];
+    blob_id = (*alias)[blob_id];
+  }
+  return blob_id;
+}
+
+template <typename Dtype>
+void Net<Dtype>::BlobAliases(vector<int>* alias) const {
+  alias->resize(blobs_.size());
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    (*alias)[blob_id] = blob_id;
+  }
+  // Reshape-like layers share their bottom's memory from setup on.
+  map<const void*, int> memory_owner;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (!blobs_[blob_id]->data()) { continue; }
+    const void* memory = blobs_[blob_id]->data().get();
+    if (memory_owner.find(memory) == memory_owner.end()) {
+      memory_owner[memory] = blob_id;
+    } else {
+      (*alias)[find_alias(alias, blob_id)] =
+          find_alias(alias, memory_owner[memory]);
+    }
+  }
+  // Split layers share their bottom's data in Forward.
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (string(layers_[layer_id]->type()) != "Split") { continue; }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      (*alias)[find_alias(alias, top_id_vecs_[layer_id][i])] =
+          find_alias(alias, bottom_id_vecs_[layer_id][0]);
+    }
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    (*alias)[blob_id] = find_alias(alias, blob_id);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanActivationMemory() {
+  // Blobs that alias each other form a group that lives from its first top
+  // to its last use by any layer.
+  vector<int> alias;
+  BlobAliases(&alias);
+  map<int, int> group_index;
+  vector<vector<int> > group_blobs;
+  vector<int> group_first, group_last;
+  vector<size_t> group_bytes;
+  vector<bool> group_pinned;
+  vector<int> blob_group(blobs_.size());
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const int root = alias[blob_id];
+    if (group_index.find(root) == group_index.end()) {
+      group_index[root] = group_blobs.size();
+      group_blobs.push_back(vector<int>());
+      group_first.push_back(-1);
+      group_last.push_back(-1);
+      group_bytes.push_back(0);
+      group_pinned.push_back(false);
+    }
+    const int group = group_index[root];
+    blob_group[blob_id] = group;
+    group_blobs[group].push_back(blob_id);
+    group_bytes[group] = std::max(group_bytes[group],
+        blobs_[blob_id]->count() * sizeof(Dtype));
+  }
+  // The net inputs and outputs must keep their values, and layers without
+  // bottoms (data layers) may point their tops at their own buffers.
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    group_pinned[blob_group[net_input_blob_indices_[i]]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    group_pinned[blob_group[net_output_blob_indices_[i]]] = true;
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      const int group = blob_group[bottom_id_vecs_[layer_id][i]];
+      group_last[group] = std::max(group_last[group], layer_id);
+    }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int group = blob_group[top_id_vecs_[layer_id][i]];
+      if (group_first[group] < 0) {
+        group_first[group] = layer_id;
+      }
+      group_last[group] = std::max(group_last[group], layer_id);
+      group_pinned[group] = group_pinned[group] ||
+          bottom_id_vecs_[layer_id].empty();
+    }
+  }
+  // Greedily hand each group, in order of definition, the best fitting buffer
+  // whose previous occupant is dead by then; allocate a new one otherwise.
+  vector<pair<int, int> > order;
+  for (int group = 0; group < group_blobs.size(); ++group) {
+    if (!group_pinned[group] && group_first[group] >= 0) {
+      order.push_back(std::make_pair(group_first[group], group));
+    }
+  }
+  std::sort(order.begin(), order.end());
+  vector<size_t> buffer_bytes;
+  vector<int> buffer_last;
+  vector<int> group_buffer(group_blobs.size(), -1);
+  size_t planned_bytes = 0;
+  for (int i = 0; i < order.size(); ++i) {
+    const int group = order[i].second;
+    const size_t bytes = group_bytes[group];
+    planned_bytes += bytes;
+    int best = -1;
+    for (int buffer = 0; buffer < buffer_bytes.size(); ++buffer) {
+      if (buffer_last[buffer] >= group_first[group]) { continue; }
+      if (best < 0) {
+        best = buffer;
+      } else if (buffer_bytes[best] < bytes) {
+        if (buffer_bytes[buffer] > buffer_bytes[best]) { best = buffer; }
+      } else if (buffer_bytes[buffer] >= bytes &&
+                 buffer_bytes[buffer] < buffer_bytes[best]) {
+        best = buffer;
+      }
+    }
+    if (best < 0) {
+      best = buffer_bytes.size();
+      buffer_bytes.push_back(0);
+      buffer_last.push_back(-1);
+    }
+    buffer_bytes[best] = std::max(buffer_bytes[best], bytes);
+    buffer_last[best] = group_last[group];
+    group_buffer[group] = best;
+  }
+  activation_memory_.clear();
+  size_t shared_bytes = 0;
+  for (int buffer = 0; buffer < buffer_bytes.size(); ++buffer) {
+    activation_memory_.push_back(
+        shared_ptr<SyncedMemory>(new SyncedMemory(buffer_bytes[buffer])));
+    shared_bytes += buffer_bytes[buffer];
+  }
+  for (int group = 0; group < group_blobs.size(); ++group) {
+    if (group_buffer[group] < 0) { continue; }
+    for (int i = 0; i < group_blobs[group].size(); ++i) {
+      blobs_[group_blobs[group][i]]->ShareDataMemory(
+          activation_memory_[group_buffer[group]]);
+    }
+  }
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Sharing " << order.size() << " activations in "
+      << activation_memory_.size() << " buffers: " << shared_bytes
+      << " bytes instead of " << planned_bytes;
+}
+
+// Whether a second Forward of the layer, to recompute its tops, gives the
+// same tops without side effects: not for Dropout at TRAIN time, which would
+// draw a new mask, nor for BatchNorm updating its moving averages.
+static bool is_rerunnable(const LayerParameter& param) {
+  if (param.checkpoint()) {
+    return false;
+  }
+  if (param.type() == "Dropout") {
+    return param.phase() != TRAIN;
+  }
+  if (param.type() == "BatchNorm") {
+    return param.batch_norm_param().has_use_global_stats() ?
+        param.batch_norm_param().use_global_stats() : param.phase() == TEST;
+  }
+  return true;
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanCheckpoints() {
+  layer_segment_.assign(layers_.size(), -1);
+  segment_begin_.clear();
+  segment_end_.clear();
+  int begin = 0;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (layers_[layer_id]->layer_param().checkpoint()) {
+      for (int i = begin; i <= layer_id; ++i) {
+        layer_segment_[i] = segment_begin_.size();
+      }
+      segment_begin_.push_back(begin);
+      segment_end_.push_back(layer_id);
+      begin = layer_id + 1;
+    }
+  }
+  const int num_segments = segment_begin_.size();
+  segment_release_blobs_.assign(num_segments, vector<int>());
+  segment_recompute_layers_.assign(num_segments, vector<int>());
+  segment_released_.assign(num_segments, false);
+  if (num_segments == 0) { return; }
+  // A blob can be released if every layer using it lies in one segment and
+  // every layer writing it can be rerun: not a checkpoint, not a data layer
+  // and not stochastic or stateful (is_rerunnable). Net outputs and loss tops
+  // are always kept.
+  vector<int> blob_segment(blobs_.size(), -2);
+  vector<bool> releasable(blobs_.size(), true);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const int segment = layer_segment_[layer_id];
+    const bool rerunnable = is_rerunnable(layers_[layer_id]->layer_param()) &&
+        !bottom_id_vecs_[layer_id].empty();
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      releasable[top_id_vecs_[layer_id][i]] =
+          releasable[top_id_vecs_[layer_id][i]] && rerunnable;
+    }
+    vector<int> used(bottom_id_vecs_[layer_id]);
+    used.insert(used.end(), top_id_vecs_[layer_id].begin(),
+        top_id_vecs_[layer_id].end());
+    for (int i = 0; i < used.size(); ++i) {
+      const int blob_id = used[i];
+      if (blob_segment[blob_id] == -2) {
+        blob_segment[blob_id] = segment;
+      } else if (blob_segment[blob_id] != segment) {
+        releasable[blob_id] = false;
+      }
+    }
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (blob_segment[blob_id] < 0 || blob_loss_weights_[blob_id] != 0) {
+      releasable[blob_id] = false;
+    }
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    releasable[net_output_blob_indices_[i]] = false;
+  }
+  // Blobs sharing memory (Split tops and their bottom, reshapes) are released
+  // together or not at all, and a layer is rerun only if all of its tops are
+  // released, so that it never overwrites a kept blob.
+  vector<int> alias;
+  BlobAliases(&alias);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+      const int root = alias[blob_id];
+      if (releasable[blob_id] != releasable[root]) {
+        releasable[blob_id] = releasable[root] = false;
+        changed = true;
+      }
+    }
+    for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+      const vector<int>& tops = top_id_vecs_[layer_id];
+      bool all_releasable = true;
+      for (int i = 0; i < tops.size(); ++i) {
+        all_releasable = all_releasable && releasable[tops[i]];
+      }
+      for (int i = 0; i < tops.size() && !all_releasable; ++i) {
+        changed = changed || releasable[tops[i]];
+        releasable[tops[i]] = false;
+      }
+    }
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const vector<int>& tops = top_id_vecs_[layer_id];
+    if (tops.empty() || !releasable[tops[0]]) { continue; }
+    const int segment = layer_segment_[layer_id];
+    segment_recompute_layers_[segment].push_back(layer_id);
+    for (int i = 0; i < tops.size(); ++i) {
+      vector<int>& blobs = segment_release_blobs_[segment];
+      if (std::find(blobs.begin(), blobs.end(), tops[i]) == blobs.end()) {
+        blobs.push_back(tops[i]);
+      }
+    }
+  }
+  for (int segment = 0; segment < num_segments; ++segment) {
+    LOG_IF(INFO, Caffe::root_solver())
+        << "Checkpoint segment " << layer_names_[segment_begin_[segment]]
+        << " to " << layer_names_[segment_end_[segment]] << " recomputes "
+        << segment_release_blobs_[segment].size() << " activations";
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ReleaseSegment(const int segment) {
+  const vector<int>& blobs = segment_release_blobs_[segment];
+  for (int i = 0; i < blobs.size(); ++i) {
+    blobs_[blobs[i]]->ReleaseMemory();
+  }
+  segment_released_[segment] = !blobs.empty();
+}
+
+template <typename Dtype>
+void Net<Dtype>::RecomputeSegment(const int segment) {
+  const vector<int>& layers = segment_recompute_layers_[segment];
+  for (int i = 0; i < layers.size(); ++i) {
+    layers_[layers[i]]->Forward(bottom_vecs_[layers[i]], top_vecs_[layers[i]]);
+  }
+  segment_released_[segment] = false;
+}
+
 template <typename Dtype>
 void Net<Dtype>::FilterNet(const NetParameter& param,
     NetParameter* param_filtered) {
@@ -565,6 +880,10 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
     for (int c = 0; c < after_forward_.size(); ++c) {
       after_forward_[c]->run(i);
     }  
+    if (!layer_segment_.empty() && layer_segment_[i] >= 0 &&
+        segment_end_[layer_segment_[i]] == i) {
+      ReleaseSegment(layer_segment_[i]);
+    }
   }   
 
   // if(iteration_number == 10) {
@@ -635,6 +954,10 @@ void Net<Dtype>::BackwardFromTo(int start, int end) {
     for (int c = 0; c < before_backward_.size(); ++c) {
       before_backward_[c]->run(i);
     }
+    const int segment = layer_segment_.empty() ? -1 : layer_segment_[i];
+    if (segment >= 0 && segment_released_[segment]) {
+      RecomputeSegment(segment);
+    }
     if (layer_need_backward_[i]) {
       // high_resolution_clock::time_point layer_start_time = high_resolution_clock::now();
 
@@ -649,6 +972,9 @@ void Net<Dtype>::BackwardFromTo(int start, int end) {
     for (int c = 0; c < after_backward_.size(); ++c) {
       after_backward_[c]->run(i);
     }
+    if (segment >= 0 && segment_begin_[segment] == i) {
+      ReleaseSegment(segment);
+    }
   }
   // std::cout << "backward from to " << start << " " << end << std::endl;
   // iteration_number++;
@@ -860,10 +1186,44 @@ void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
   }
 }
 
+// Layout of the files written by ToMappedWeights, in native byte order: the
+// header, then per param its layer name (length-prefixed), index in the
+// layer, shape and data offset, and the data of each param aligned to
+// kMappedWeightsAlign bytes from the start of the file.
+static const char kMappedWeightsMagic[8] = {'C', 'A', 'F', 'F', 'E', 'M', 'A', 'P'};
+static const uint32_t kMappedWeightsVersion = 1;
+static const uint64_t kMappedWeightsAlign = 64;
+
+struct MappedWeightsHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t dtype_size;
+  uint32_t num_params;
+};
+
+static bool is_mapped_weights(const string& filename) {
+  std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+  char magic[sizeof(kMappedWeightsMagic)];
+  return file.read(magic, sizeof(magic)) &&
+      std::equal(magic, magic + sizeof(magic), kMappedWeightsMagic);
+}
+
+// Reads a T at *pos of the mapped file and advances *pos past it.
+template <typename T>
+static T read_mapped(const char* data, const size_t size, size_t* pos) {
+  CHECK_LE(*pos + sizeof(T), size) << "Truncated weights file";
+  T value;
+  memcpy(&value, data + *pos, sizeof(T));
+  *pos += sizeof(T);
+  return value;
+}
+
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const string trained_filename) {
   if (H5Fis_hdf5(trained_filename.c_str())) {
     CopyTrainedLayersFromHDF5(trained_filename);
+  } else if (is_mapped_weights(trained_filename)) {
+    MapTrainedLayersFrom(trained_filename);
   } else {
     CopyTrainedLayersFromBinaryProto(trained_filename);
   }
@@ -879,6 +1239,7 @@ void Net<Dtype>::CopyTrainedLayersFromBinaryProto(
 
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   hid_t file_hid = H5Fopen(trained_filename.c_str(), H5F_ACC_RDONLY,
                            H5P_DEFAULT);
   CHECK_GE(file_hid, 0) << "Couldn't open " << trained_filename;
@@ -927,6 +1288,60 @@ void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
   H5Fclose(file_hid);
 }
 
+template <typename Dtype>
+void Net<Dtype>::MapTrainedLayersFrom(const string trained_filename) {
+  using boost::interprocess::file_mapping;
+  using boost::interprocess::mapped_region;
+  shared_ptr<mapped_region> region;
+  try {
+    file_mapping file(trained_filename.c_str(), boost::interprocess::read_only);
+    region.reset(new mapped_region(file, boost::interprocess::copy_on_write));
+  } catch (std::exception& e) {
+    LOG(FATAL) << "Couldn't map " << trained_filename << ": " << e.what();
+  }
+  char* data = static_cast<char*>(region->get_address());
+  const size_t size = region->get_size();
+  size_t pos = 0;
+  const MappedWeightsHeader header =
+      read_mapped<MappedWeightsHeader>(data, size, &pos);
+  CHECK(std::equal(header.magic, header.magic + sizeof(header.magic),
+      kMappedWeightsMagic)) << trained_filename << " is not a weights file";
+  CHECK_EQ(header.version, kMappedWeightsVersion)
+      << "Unsupported weights file version";
+  CHECK_EQ(header.dtype_size, sizeof(Dtype))
+      << "Weights were written for another Dtype";
+  for (int i = 0; i < header.num_params; ++i) {
+    const uint32_t name_size = read_mapped<uint32_t>(data, size, &pos);
+    CHECK_LE(pos + name_size, size) << "Truncated weights file";
+    const string source_layer_name(data + pos, name_size);
+    pos += name_size;
+    const uint32_t param_id = read_mapped<uint32_t>(data, size, &pos);
+    vector<int> shape(read_mapped<uint32_t>(data, size, &pos));
+    for (int j = 0; j < shape.size(); ++j) {
+      shape[j] = read_mapped<int32_t>(data, size, &pos);
+    }
+    const uint64_t offset = read_mapped<uint64_t>(data, size, &pos);
+    if (!layer_names_index_.count(source_layer_name)) {
+      LOG(INFO) << "Ignoring source layer " << source_layer_name;
+      continue;
+    }
+    DLOG(INFO) << "Mapping source layer " << source_layer_name;
+    const int target_layer_id = layer_names_index_[source_layer_name];
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
+        layers_[target_layer_id]->blobs();
+    CHECK_LT(param_id, target_blobs.size())
+        << "Incompatible number of blobs for layer " << source_layer_name;
+    Blob<Dtype>* target_blob = target_blobs[param_id].get();
+    CHECK(target_blob->shape() == shape) << "Cannot map param " << param_id
+        << " of layer '" << source_layer_name << "'; shape mismatch.  "
+        << "Target param shape is " << target_blob->shape_string();
+    CHECK_LE(offset + target_blob->count() * sizeof(Dtype), size)
+        << "Truncated weights file";
+    target_blob->set_cpu_data(reinterpret_cast<Dtype*>(data + offset));
+  }
+  mapped_weights_.push_back(region);
+}
+
 template <typename Dtype>
 void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
   param->Clear();
@@ -941,6 +1356,7 @@ void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
 
 template <typename Dtype>
 void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   hid_t file_hid = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
       H5P_DEFAULT);
   CHECK_GE(file_hid, 0)
@@ -996,6 +1412,78 @@ void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
   H5Fclose(file_hid);
 }
 
+template <typename Dtype>
+void Net<Dtype>::ToMappedWeights(const string& filename) const {
+  // Only save params that own themselves, as ToHDF5 does.
+  vector<int> layer_ids, param_ids;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int param_id = 0; param_id < layers_[layer_id]->blobs().size();
+         ++param_id) {
+      if (param_owners_[param_id_vecs_[layer_id][param_id]] == -1) {
+        layer_ids.push_back(layer_id);
+        param_ids.push_back(param_id);
+      }
+    }
+  }
+  ostringstream index;
+  MappedWeightsHeader header;
+  std::copy(kMappedWeightsMagic, kMappedWeightsMagic + sizeof(header.magic),
+      header.magic);
+  header.version = kMappedWeightsVersion;
+  header.dtype_size = sizeof(Dtype);
+  header.num_params = layer_ids.size();
+  index.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  // The data follows the index, so lay out the index first.
+  uint64_t index_size = sizeof(header);
+  for (int i = 0; i < layer_ids.size(); ++i) {
+    index_size += 3 * sizeof(uint32_t) + sizeof(uint64_t) +
+        layer_names_[layer_ids[i]].size() +
+        layers_[layer_ids[i]]->blobs()[param_ids[i]]->num_axes() *
+        sizeof(int32_t);
+  }
+  vector<uint64_t> offsets(layer_ids.size());
+  uint64_t offset = index_size;
+  for (int i = 0; i < layer_ids.size(); ++i) {
+    offset = (offset + kMappedWeightsAlign - 1) / kMappedWeightsAlign *
+        kMappedWeightsAlign;
+    offsets[i] = offset;
+    offset += layers_[layer_ids[i]]->blobs()[param_ids[i]]->count() *
+        sizeof(Dtype);
+  }
+  for (int i = 0; i < layer_ids.size(); ++i) {
+    const string& name = layer_names_[layer_ids[i]];
+    const Blob<Dtype>& blob = *layers_[layer_ids[i]]->blobs()[param_ids[i]];
+    const uint32_t name_size = name.size();
+    const uint32_t param_id = param_ids[i];
+    const uint32_t num_axes = blob.num_axes();
+    index.write(reinterpret_cast<const char*>(&name_size), sizeof(name_size));
+    index.write(name.data(), name_size);
+    index.write(reinterpret_cast<const char*>(&param_id), sizeof(param_id));
+    index.write(reinterpret_cast<const char*>(&num_axes), sizeof(num_axes));
+    for (int j = 0; j < num_axes; ++j) {
+      const int32_t dim = blob.shape(j);
+      index.write(reinterpret_cast<const char*>(&dim), sizeof(dim));
+    }
+    index.write(reinterpret_cast<const char*>(&offsets[i]),
+        sizeof(offsets[i]));
+  }
+  CHECK_EQ(index.str().size(), index_size);
+  std::ofstream file(filename.c_str(),
+      std::ios::out | std::ios::binary | std::ios::trunc);
+  CHECK(file.is_open()) << "Couldn't open " << filename << " to save weights.";
+  file << index.str();
+  uint64_t written = index_size;
+  const char padding[kMappedWeightsAlign] = {};
+  for (int i = 0; i < layer_ids.size(); ++i) {
+    const Blob<Dtype>& blob = *layers_[layer_ids[i]]->blobs()[param_ids[i]];
+    file.write(padding, offsets[i] - written);
+    file.write(reinterpret_cast<const char*>(blob.cpu_data()),
+        blob.count() * sizeof(Dtype));
+    written = offsets[i] + blob.count() * sizeof(Dtype);
+  }
+  CHECK(file.good()) << "Error saving weights to " << filename << ".";
+}
+
 template <typename Dtype>
 void Net<Dtype>::Update() {
   for (int i = 0; i < learnable_params_.size(); ++i) {
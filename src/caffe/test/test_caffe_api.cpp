@@ -0,0 +1,320 @@
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "boost/bind.hpp"
+#include "boost/thread.hpp"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/api/CaffeAPI.h"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Runs inputs[i] through api->infer() for every i = thread (mod num_threads).
+static void infer_inputs(Caffe_API* api, const vector<vector<float> >* inputs,
+    const int thread, const int num_threads, vector<vector<float> >* outputs) {
+  for (int i = thread; i < inputs->size(); i += num_threads) {
+    api->infer(&(*inputs)[i][0], (*outputs)[i]);
+  }
+}
+
+// Submits inputs[i] to api for every i = thread (mod num_threads).
+static void submit_inputs(Caffe_API* api, const vector<vector<float> >* inputs,
+    const int thread, const int num_threads,
+    vector<boost::shared_future<vector<float> > >* outputs) {
+  for (int i = thread; i < inputs->size(); i += num_threads) {
+    (*outputs)[i] = api->submit(&(*inputs)[i][0]);
+  }
+}
+
+class CaffeAPITest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    Caffe::set_mode(Caffe::CPU);
+    Caffe::set_random_seed(1701);
+  }
+
+  // Writes a net scaling its num x 1 x depth x height x width input by
+  // weight through a 1x1x1 convolution, or summing each kernel^3 neighbourhood
+  // (zero-padded) times weight, and its trained weights.
+  void MakeNet(const int num, const int depth, const int height,
+      const int width, const float weight = 1, const int kernel = 1) {
+    std::ostringstream proto;
+    proto << "name: 'scale' layer { name: 'data' type: 'Input' top: 'data' "
+        << "input_param { shape { dim: " << num << " dim: 1 dim: " << depth
+        << " dim: " << height << " dim: " << width << " } } } "
+        << "layer { name: 'conv' type: 'Convolution' bottom: 'data' "
+        << "top: 'conv' convolution_param { num_output: 1 kernel_size: "
+        << kernel << " pad: " << kernel / 2 << " "
+        << "weight_filler { type: 'constant' value: " << weight << " } "
+        << "bias_term: false } }";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto.str(), &param));
+    MakeTempFilename(&proto_file_);
+    WriteProtoToTextFile(param, proto_file_);
+    Net<float> net(param);
+    NetParameter trained;
+    net.ToProto(&trained);
+    MakeTempFilename(&trained_file_);
+    WriteProtoToBinaryFile(trained, trained_file_);
+    count_ = num * depth * height * width;
+  }
+
+  vector<float> RandomInput(const int count) {
+    vector<float> input(count);
+    caffe_rng_uniform(count, -1.f, 1.f, &input[0]);
+    return input;
+  }
+
+  string proto_file_;
+  string trained_file_;
+  int count_;
+};
+
+TEST_F(CaffeAPITest, TestInferConcurrent) {
+  const float weight = 2;
+  MakeNet(2, 8, 16, 16, weight);
+  Caffe_API api;
+  api.setMode(false);
+  api.readNetwork(proto_file_, trained_file_, 2);
+  EXPECT_EQ(api.numReplicas(), 2);
+  const int num_inputs = 64;
+  const int num_threads = 4;
+  vector<vector<float> > inputs, outputs(num_inputs);
+  for (int i = 0; i < num_inputs; ++i) {
+    inputs.push_back(RandomInput(count_));
+  }
+  // Run the single-threaded API on the first net while the threads infer on
+  // the replicas: neither may see the other's data.
+  boost::thread_group threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.create_thread(boost::bind(&infer_inputs, &api, &inputs, t,
+        num_threads, &outputs));
+  }
+  for (int i = 0; i < num_inputs; ++i) {
+    api.inputData(&inputs[i][0], "data");
+    api.run();
+    vector<float> output;
+    api.outputData(output, "conv");
+    ASSERT_EQ(count_, output.size());
+    for (int j = 0; j < count_; ++j) {
+      EXPECT_EQ(weight * inputs[i][j], output[j]);
+    }
+  }
+  threads.join_all();
+  for (int i = 0; i < num_inputs; ++i) {
+    ASSERT_EQ(count_, outputs[i].size());
+    for (int j = 0; j < count_; ++j) {
+      EXPECT_EQ(weight * inputs[i][j], outputs[i][j]);
+    }
+  }
+}
+
+TEST_F(CaffeAPITest, TestBind) {
+  const float weight = 3;
+  MakeNet(2, 3, 4, 5, weight);
+  Caffe_API api;
+  api.setMode(false);
+  api.readNetwork(proto_file_, trained_file_);
+  vector<float> input(count_), output(count_);
+  api.bindInput(&input[0], "data");
+  api.bindOutput(&output[0], "conv");
+  // Each run reads what the caller last wrote to the bound input buffer.
+  for (int iter = 0; iter < 3; ++iter) {
+    caffe_rng_uniform(count_, -1.f, 1.f, &input[0]);
+    api.run();
+    for (int j = 0; j < count_; ++j) {
+      EXPECT_EQ(weight * input[j], output[j]) << "debug: iter " << iter;
+    }
+  }
+}
+
+TEST_F(CaffeAPITest, TestInputVolume) {
+  // Past the tile of the blocked copy along every axis.
+  const int shape[3] = { 17, 19, 21 };
+  MakeNet(1, shape[0], shape[1], shape[2]);
+  Caffe_API api;
+  api.setMode(false);
+  api.readNetwork(proto_file_, trained_file_);
+  const int axes[][3] = { { 0, 1, 2 }, { 2, 1, 0 }, { 1, 2, 0 } };
+  for (int a = 0; a < 3; ++a) {
+    int data_shape[3];
+    for (int i = 0; i < 3; ++i) {
+      data_shape[axes[a][i]] = shape[i];
+    }
+    for (int dense = 0; dense < 2; ++dense) {
+      // Padded rows and planes, and every other element along the last axis.
+      int strides[3];
+      strides[2] = dense ? 1 : 2;
+      strides[1] = data_shape[2] * strides[2] + (dense ? 0 : 3);
+      strides[0] = data_shape[1] * strides[1] + (dense ? 0 : 5);
+      vector<float> data(data_shape[0] * strides[0]);
+      for (int i = 0; i < data.size(); ++i) {
+        data[i] = i;
+      }
+      for (int num_threads = 1; num_threads <= 3; num_threads += 2) {
+        vector<float> zeros(count_, 0);
+        api.inputData(&zeros[0], "data");
+        api.inputVolume(&data[0], axes[a], "data", dense ? NULL : strides,
+            num_threads);
+        vector<float> blob_data;
+        api.outputData(blob_data, "data");
+        ASSERT_EQ(count_, blob_data.size());
+        int index = 0;
+        for (int z = 0; z < shape[0]; ++z) {
+          for (int y = 0; y < shape[1]; ++y) {
+            for (int x = 0; x < shape[2]; ++x, ++index) {
+              const int data_index = z * strides[axes[a][0]] +
+                  y * strides[axes[a][1]] + x * strides[axes[a][2]];
+              EXPECT_EQ(data[data_index], blob_data[index])
+                  << "debug: axes " << a << " dense " << dense << " threads "
+                  << num_threads << " z " << z << " y " << y << " x " << x;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_F(CaffeAPITest, TestInferVolumeIdentity) {
+  // Tiles through the identity net blend back to the volume whatever their
+  // origins, weights or batching, as long as they cover every voxel.
+  const int tile[3] = { 4, 5, 6 };
+  MakeNet(1, tile[0], tile[1], tile[2]);
+  Caffe_API api;
+  api.setMode(false);
+  api.readNetwork(proto_file_, trained_file_, 1);
+  vector<float> bound(count_), bound_output(count_);
+  api.bindInput(&bound[0], "data");
+  api.bindOutput(&bound_output[0], "conv");
+  // No tile multiple along any axis, then smaller than the tile.
+  const int shapes[][3] = { { 11, 7, 13 }, { 3, 5, 2 } };
+  const int overlaps[][3] = { { 0, 0, 0 }, { 1, 2, 3 } };
+  for (int s = 0; s < 2; ++s) {
+    const int* shape = shapes[s];
+    const vector<float> volume = RandomInput(shape[0] * shape[1] * shape[2]);
+    for (int o = 0; o < 2; ++o) {
+      for (int gaussian = 0; gaussian < 2; ++gaussian) {
+        for (int batch_size = 1; batch_size <= 3; batch_size += 2) {
+          vector<float> output;
+          api.inferVolume(&volume[0], shape, tile, overlaps[o], output,
+              batch_size, gaussian);
+          ASSERT_EQ(volume.size(), output.size());
+          for (int i = 0; i < volume.size(); ++i) {
+            EXPECT_NEAR(volume[i], output[i], 1e-5)
+                << "debug: shape " << s << " overlap " << o << " gaussian "
+                << gaussian << " batch_size " << batch_size << " index " << i;
+          }
+        }
+      }
+    }
+  }
+  // The net of run() keeps its bindings through inferVolume().
+  caffe_rng_uniform(count_, -1.f, 1.f, &bound[0]);
+  api.run();
+  for (int j = 0; j < count_; ++j) {
+    EXPECT_EQ(bound[j], bound_output[j]);
+  }
+}
+
+TEST_F(CaffeAPITest, TestInferVolumeBlend) {
+  // Summing the 3-voxel neighbourhoods of ones gives 2 at the borders of the
+  // tiles of 6 and 3 inside: the tiles at 0 and 4 of a volume of 10 blend
+  // their 3 and 2 over the 2 voxels of overlap.
+  const float linear[2] = { 4.f / 7, 2.f / 7 };
+  const float gaussian[2] = { std::exp(-2.f), std::exp(-50.f / 9) };
+  const float blend[2] = {
+      (3 * linear[0] + 2 * linear[1]) / (linear[0] + linear[1]),
+      (3 * gaussian[0] + 2 * gaussian[1]) / (gaussian[0] + gaussian[1]) };
+  const float expected[2][10] = {
+      { 2, 3, 3, 3, blend[0], blend[0], 3, 3, 3, 2 },
+      { 2, 3, 3, 3, blend[1], blend[1], 3, 3, 3, 2 } };
+  const vector<float> volume(10, 1.f);
+  for (int axis = 0; axis < 3; ++axis) {
+    int shape[3] = { 1, 1, 1 };
+    int tile[3] = { 1, 1, 1 };
+    int overlap[3] = { 0, 0, 0 };
+    shape[axis] = 10;
+    tile[axis] = 6;
+    overlap[axis] = 2;
+    MakeNet(1, tile[0], tile[1], tile[2], 1, 3);
+    Caffe_API api;
+    api.setMode(false);
+    api.readNetwork(proto_file_, trained_file_, 1);
+    for (int g = 0; g < 2; ++g) {
+      for (int batch_size = 1; batch_size <= 3; batch_size += 2) {
+        vector<float> output;
+        api.inferVolume(&volume[0], shape, tile, overlap, output, batch_size,
+            g);
+        ASSERT_EQ(volume.size(), output.size());
+        for (int i = 0; i < volume.size(); ++i) {
+          EXPECT_NEAR(expected[g][i], output[i], 1e-5)
+              << "debug: axis " << axis << " gaussian " << g << " batch_size "
+              << batch_size << " index " << i;
+        }
+      }
+    }
+  }
+}
+
+TEST_F(CaffeAPITest, TestSubmitConcurrent) {
+  const float weight = 2;
+  MakeNet(1, 4, 5, 6, weight);
+  Caffe_API api;
+  api.setMode(false);
+  api.readNetwork(proto_file_, trained_file_, 1);
+  const int max_batch = 4;
+  api.startBatching(max_batch, 1000);
+  // More requests than fit in a batch, from several threads at once.
+  const int num_inputs = 5 * max_batch + 1;
+  const int num_threads = 3;
+  vector<vector<float> > inputs;
+  for (int i = 0; i < num_inputs; ++i) {
+    inputs.push_back(RandomInput(count_));
+  }
+  vector<boost::shared_future<vector<float> > > outputs(num_inputs);
+  boost::thread_group threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.create_thread(boost::bind(&submit_inputs, &api, &inputs, t,
+        num_threads, &outputs));
+  }
+  threads.join_all();
+  for (int i = 0; i < num_inputs; ++i) {
+    const vector<float>& output = outputs[i].get();
+    ASSERT_EQ(count_, output.size());
+    for (int j = 0; j < count_; ++j) {
+      EXPECT_EQ(weight * inputs[i][j], output[j]) << "debug: request " << i;
+    }
+  }
+  api.stopBatching();
+}
+
+TEST_F(CaffeAPITest, TestSubmitFlushesAfterWait) {
+  MakeNet(1, 2, 3, 4);
+  Caffe_API api;
+  api.setMode(false);
+  api.readNetwork(proto_file_, trained_file_, 1);
+  const int max_wait_us = 20000;
+  api.startBatching(8, max_wait_us);
+  const vector<float> input = RandomInput(count_);
+  CPUTimer timer;
+  timer.Start();
+  boost::shared_future<vector<float> > output = api.submit(&input[0]);
+  // A lone request never fills the batch, and runs once max_wait_us is over.
+  ASSERT_TRUE(output.timed_wait(boost::posix_time::seconds(10)));
+  EXPECT_GE(timer.MicroSeconds(), max_wait_us);
+  ASSERT_EQ(count_, output.get().size());
+  for (int j = 0; j < count_; ++j) {
+    EXPECT_EQ(input[j], output.get()[j]);
+  }
+  api.stopBatching();
+}
+
+}  // namespace caffe
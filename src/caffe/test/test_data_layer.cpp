@@ -1,4 +1,5 @@
 #ifdef USE_OPENCV
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -67,7 +68,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     db->Close();
   }
 
-  void TestRead() {
+  void TestRead(const int decode_threads = 1) {
     const Dtype scale = 3;
     LayerParameter param;
     param.set_phase(TRAIN);
@@ -75,6 +76,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_decode_threads(decode_threads);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -250,13 +252,14 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
-  void TestReadCropTrainSequenceSeeded() {
+  void TestReadCropTrainSequenceSeeded(const int decode_threads = 1) {
     LayerParameter param;
     param.set_phase(TRAIN);
     DataParameter* data_param = param.mutable_data_param();
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_decode_threads(decode_threads);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -362,6 +365,72 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  void TestReadCache(Phase phase, const bool shuffle,
+      const int decode_threads = 1) {
+    const Dtype scale = 3;
+    const int batch_size = 3;
+    LayerParameter param;
+    param.set_phase(phase);
+    Caffe::set_random_seed(seed_);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(batch_size);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_decode_threads(decode_threads);
+    data_param->set_cache(true);
+    data_param->set_shuffle(shuffle);
+
+    TransformationParameter* transform_param =
+        param.mutable_transform_param();
+    transform_param->set_scale(scale);
+    transform_param->add_mean_value(1);
+    transform_param->set_crop_size(2);
+    transform_param->set_mirror(true);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    EXPECT_EQ(blob_top_data_->num(), batch_size);
+    EXPECT_EQ(blob_top_data_->channels(), 2);
+    EXPECT_EQ(blob_top_data_->height(), 2);
+    EXPECT_EQ(blob_top_data_->width(), 2);
+
+    // Batches straddle epochs of 5 items: collect the labels served.
+    vector<int> labels;
+    for (int iter = 0; iter < 10; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int i = 0; i < batch_size; ++i) {
+        const int label = blob_top_label_->cpu_data()[i];
+        labels.push_back(label);
+        for (int j = 0; j < 8; ++j) {
+          EXPECT_EQ(scale * (label - 1), blob_top_data_->cpu_data()[i * 8 + j])
+              << "debug: iter " << iter << " i " << i << " j " << j;
+        }
+      }
+    }
+    // The first epoch is read in order, and each epoch serves every item
+    // once; in order unless shuffling.
+    int num_shuffled_epochs = 0;
+    for (int epoch = 0; epoch < labels.size() / 5; ++epoch) {
+      vector<int> epoch_labels(labels.begin() + epoch * 5,
+          labels.begin() + (epoch + 1) * 5);
+      bool in_order = true;
+      for (int i = 0; i < 5; ++i) {
+        in_order = in_order && epoch_labels[i] == i;
+      }
+      num_shuffled_epochs += !in_order;
+      if (epoch == 0 || !shuffle) {
+        EXPECT_TRUE(in_order) << "debug: epoch " << epoch;
+      }
+      std::sort(epoch_labels.begin(), epoch_labels.end());
+      for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(i, epoch_labels[i]) << "debug: epoch " << epoch;
+      }
+    }
+    if (shuffle) {
+      EXPECT_GT(num_shuffled_epochs, 0);
+    }
+  }
+
   virtual ~DataLayerTest() { delete blob_top_data_; delete blob_top_label_; }
 
   DataParameter_DB backend_;
@@ -382,6 +451,12 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadDecodeThreadsLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestRead(3);
+}
+
 TYPED_TEST(DataLayerTest, TestSkipLevelDB) {
   this->Fill(false, DataParameter_DB_LEVELDB);
   this->TestSkip();
@@ -405,6 +480,14 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLevelDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+// Test that the sequence stays consistent when several threads decode the
+// batch.
+TYPED_TEST(DataLayerTest, TestReadCropTrainSeededThreadsLevelDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadCropTrainSequenceSeeded(2);
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLevelDB) {
@@ -418,6 +501,21 @@ TYPED_TEST(DataLayerTest, TestReadCropTestLevelDB) {
   this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
   this->TestReadCrop(TEST);
 }
+
+TYPED_TEST(DataLayerTest, TestReadCacheLevelDB) {
+  this->Fill(false, DataParameter_DB_LEVELDB);
+  this->TestReadCache(TRAIN, false);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCacheShuffleThreadsLevelDB) {
+  this->Fill(false, DataParameter_DB_LEVELDB);
+  this->TestReadCache(TRAIN, true, 2);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCacheTestLevelDB) {
+  this->Fill(false, DataParameter_DB_LEVELDB);
+  this->TestReadCache(TEST, false);
+}
 #endif  // USE_LEVELDB
 
 #ifdef USE_LMDB
@@ -427,6 +525,12 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadDecodeThreadsLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(3);
+}
+
 TYPED_TEST(DataLayerTest, TestSkipLMDB) {
   this->Fill(false, DataParameter_DB_LMDB);
   this->TestSkip();
@@ -450,6 +554,14 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLMDB) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+// Test that the sequence stays consistent when several threads decode the
+// batch.
+TYPED_TEST(DataLayerTest, TestReadCropTrainSeededThreadsLMDB) {
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadCropTrainSequenceSeeded(2);
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLMDB) {
@@ -464,6 +576,21 @@ TYPED_TEST(DataLayerTest, TestReadCropTestLMDB) {
   this->TestReadCrop(TEST);
 }
 
+TYPED_TEST(DataLayerTest, TestReadCacheLMDB) {
+  this->Fill(false, DataParameter_DB_LMDB);
+  this->TestReadCache(TRAIN, false);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCacheShuffleThreadsLMDB) {
+  this->Fill(false, DataParameter_DB_LMDB);
+  this->TestReadCache(TRAIN, true, 2);
+}
+
+TYPED_TEST(DataLayerTest, TestReadCacheTestLMDB) {
+  this->Fill(false, DataParameter_DB_LMDB);
+  this->TestReadCache(TEST, false);
+}
+
 #endif  // USE_LMDB
 }  // namespace caffe
 #endif  // USE_OPENCV
@@ -257,6 +257,59 @@ TYPED_TEST(DataTransformTest, TestCropMirrorTest) {
   EXPECT_LT(num_matches_crop_mirror, num_matches_crop);
 }
 
+TYPED_TEST(DataTransformTest, TestCropMirrorVolume) {
+  TransformationParameter transform_param;
+  const bool unique_pixels = true;  // pixels are consecutive ints [0,size]
+  const int label = 0;
+  const int channels = 2;
+  const int depth = 4;
+  const int height = 5;
+  const int width = 6;
+  const int crop_size = 3;
+
+  transform_param.set_crop_size(crop_size);
+  transform_param.set_mirror(true);
+  transform_param.set_scale(0.5);
+  transform_param.add_mean_value(1);
+  Datum datum;
+  FillDatum(label, channels, depth * height, width, unique_pixels, &datum);
+  datum.set_depth(depth);
+  datum.set_height(height);
+  DataTransformer<TypeParam> transformer(transform_param, TEST);
+  transformer.InitRand();
+  vector<int> shape = transformer.InferBlobShape(datum);
+  ASSERT_EQ(shape.size(), 5);
+  EXPECT_EQ(shape[1], channels);
+  EXPECT_EQ(shape[2], crop_size);
+  EXPECT_EQ(shape[3], crop_size);
+  EXPECT_EQ(shape[4], crop_size);
+  Blob<TypeParam> blob(shape);
+  // The center crop, mirrored along width or not.
+  const int d_off = (depth - crop_size) / 2;
+  const int h_off = (height - crop_size) / 2;
+  const int w_off = (width - crop_size) / 2;
+  int num_mirrored = 0;
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    transformer.Transform(datum, &blob);
+    const bool mirrored = blob.cpu_data()[0] !=
+        ((d_off * height + h_off) * width + w_off - 1) * 0.5;
+    num_mirrored += mirrored;
+    int top_index = 0;
+    for (int c = 0; c < channels; ++c) {
+      for (int d = 0; d < crop_size; ++d) {
+        for (int h = 0; h < crop_size; ++h) {
+          for (int w = 0; w < crop_size; ++w, ++top_index) {
+            const int data_index = ((c * depth + d_off + d) * height + h_off
+                + h) * width + w_off + (mirrored ? crop_size - 1 - w : w);
+            EXPECT_EQ((data_index - 1) * 0.5, blob.cpu_data()[top_index]);
+          }
+        }
+      }
+    }
+  }
+  EXPECT_GT(num_mirrored, 0);
+  EXPECT_LT(num_mirrored, this->num_iter_);
+}
 
 TYPED_TEST(DataTransformTest, TestMeanValue) {
   TransformationParameter transform_param;
@@ -1,5 +1,6 @@
 #if defined(USE_LEVELDB) && defined(USE_LMDB) && defined(USE_OPENCV)
 #include <string>
+#include <vector>
 
 #include "boost/scoped_ptr.hpp"
 #include "gtest/gtest.h"
@@ -117,6 +118,44 @@ TYPED_TEST(DBTest, TestKeyValue) {
   EXPECT_FALSE(cursor->valid());
 }
 
+TYPED_TEST(DBTest, TestValueView) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  const char* data;
+  size_t size;
+  for (; cursor->valid(); cursor->Next()) {
+    const string value = cursor->value();
+    cursor->value_view(&data, &size);
+    EXPECT_EQ(value, string(data, size));
+    Datum datum;
+    EXPECT_TRUE(datum.ParseFromArray(data, size));
+    EXPECT_EQ(datum.channels(), 3);
+  }
+}
+
+TYPED_TEST(DBTest, TestStableValueView) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  if (!cursor->stable_views()) {
+    return;
+  }
+  vector<string> values;
+  vector<const char*> views;
+  vector<size_t> sizes;
+  for (; cursor->valid(); cursor->Next()) {
+    values.push_back(cursor->value());
+    views.push_back(NULL);
+    sizes.push_back(0);
+    cursor->value_view(&views.back(), &sizes.back());
+  }
+  cursor->SeekToFirst();
+  for (int i = 0; i < values.size(); ++i) {
+    EXPECT_EQ(values[i], string(views[i], sizes[i]));
+  }
+}
+
 TYPED_TEST(DBTest, TestWrite) {
   scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
   db->Open(this->source_, db::WRITE);
@@ -6,6 +6,8 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/inner_product_layer.hpp"
+#include "caffe/layers/quantized_inner_product_layer.hpp"
+#include "caffe/util/quantize.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -208,6 +210,45 @@ TYPED_TEST(InnerProductLayerTest, TestForwardTranspose) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestForwardQuantized) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  const Dtype input_range = caffe_cpu_amax(this->blob_bottom_->count(),
+      this->blob_bottom_->cpu_data());
+  for (int transpose = 0; transpose < 2; ++transpose) {
+    LayerParameter layer_param;
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->set_transpose(transpose);
+    inner_product_param->mutable_weight_filler()->set_type("uniform");
+    inner_product_param->mutable_weight_filler()->set_min(-1);
+    inner_product_param->mutable_bias_filler()->set_type("uniform");
+    shared_ptr<InnerProductLayer<Dtype> > layer(
+        new InnerProductLayer<Dtype>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype> expected;
+    expected.CopyFrom(*this->blob_top_, false, true);
+    layer_param.mutable_quantization_param()->set_input_range(input_range);
+    shared_ptr<InnerProductLayer<Dtype> > quantized_layer(
+        new QuantizedInnerProductLayer<Dtype>(layer_param));
+    quantized_layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < layer->blobs().size(); ++i) {
+      quantized_layer->blobs()[i]->CopyFrom(*layer->blobs()[i]);
+    }
+    quantized_layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    // Up to the rounding of the 60 input and weight products per output.
+    const Dtype weight_range = caffe_cpu_amax(layer->blobs()[0]->count(),
+        layer->blobs()[0]->cpu_data());
+    const Dtype tolerance = 60 * weight_range * input_range / 127;
+    const Dtype* data = this->blob_top_->cpu_data();
+    for (int i = 0; i < expected.count(); ++i) {
+      EXPECT_NEAR(data[i], expected.cpu_data()[i], tolerance);
+    }
+  }
+}
+
 TYPED_TEST(InnerProductLayerTest, TestForwardNoBatch) {
   typedef typename TypeParam::Dtype Dtype;
   this->blob_bottom_vec_.push_back(this->blob_bottom_nobatch_);
@@ -1,3 +1,4 @@
+#include <cmath>
 #include <string>
 #include <utility>
 #include <vector>
@@ -9,6 +10,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/net.hpp"
+#include "caffe/util/fold_layers.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 
@@ -2446,6 +2448,649 @@ TYPED_TEST(NetTest, TestReshape) {
   EXPECT_FALSE(same_spatial_shape);
 }
 
+TYPED_TEST(NetTest, TestShareActivationMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'SharedActivationsNetwork' "
+      "state { phase: TEST } "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "  input_param { shape { dim: 2 dim: 6 } } "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "  inner_product_param { "
+      "    num_output: 8 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'ip1' "
+      "  top: 'ip1' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'ip1' "
+      "  top: 'ip2' "
+      "  inner_product_param { "
+      "    num_output: 8 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'sigmoid2' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'ip2' "
+      "  top: 'ip2' "
+      "} "
+      "layer { "
+      "  name: 'ip3' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'ip2' "
+      "  top: 'ip3' "
+      "  inner_product_param { "
+      "    num_output: 8 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'ip4' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'ip3' "
+      "  top: 'ip4' "
+      "  inner_product_param { "
+      "    num_output: 8 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'sum' "
+      "  type: 'Eltwise' "
+      "  bottom: 'ip3' "
+      "  bottom: 'ip4' "
+      "  top: 'sum' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> unshared_net(param);
+  param.set_share_activation_memory(true);
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> shared_net(param);
+  // ip1 is dead once ip2 is computed, so ip3 (and its split) reuse it, and
+  // likewise ip4 reuses ip2; the input and output keep their own memory.
+  EXPECT_EQ(shared_net.blob_by_name("ip1")->data(),
+            shared_net.blob_by_name("ip3")->data());
+  EXPECT_EQ(shared_net.blob_by_name("ip2")->data(),
+            shared_net.blob_by_name("ip4")->data());
+  EXPECT_NE(shared_net.blob_by_name("ip1")->data(),
+            shared_net.blob_by_name("ip2")->data());
+  EXPECT_NE(shared_net.blob_by_name("ip1")->data(),
+            shared_net.blob_by_name("data")->data());
+  EXPECT_NE(shared_net.blob_by_name("ip2")->data(),
+            shared_net.blob_by_name("sum")->data());
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(unshared_net.input_blobs()[0]);
+  shared_net.input_blobs()[0]->CopyFrom(*unshared_net.input_blobs()[0]);
+  // Run twice to check that the buffers are reused across passes.
+  for (int pass = 0; pass < 2; ++pass) {
+    unshared_net.Forward();
+    shared_net.Forward();
+    const Blob<Dtype>* expected = unshared_net.output_blobs()[0];
+    const Blob<Dtype>* actual = shared_net.output_blobs()[0];
+    ASSERT_EQ(expected->count(), actual->count());
+    for (int i = 0; i < expected->count(); ++i) {
+      EXPECT_NEAR(expected->cpu_data()[i], actual->cpu_data()[i], 1e-5);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestCheckpoint) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'CheckpointNetwork' "
+      "state { phase: TRAIN } "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  top: 'data' "
+      "  top: 'label' "
+      "  dummy_data_param { "
+      "    shape { dim: 4 dim: 5 } "
+      "    shape { dim: 4 dim: 3 } "
+      "    data_filler { type: 'gaussian' std: 1 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "  inner_product_param { "
+      "    num_output: 6 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'ip1' "
+      "  top: 'ip1' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'ip1' "
+      "  top: 'ip2' "
+      "  inner_product_param { "
+      "    num_output: 6 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  checkpoint: true "
+      "} "
+      "layer { "
+      "  name: 'sigmoid2' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'ip2' "
+      "  top: 'sigmoid2' "
+      "} "
+      "layer { "
+      "  name: 'ip3' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'sigmoid2' "
+      "  top: 'ip3' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  checkpoint: true "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'ip3' "
+      "  bottom: 'label' "
+      "  top: 'loss' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> checkpoint_net(param);
+  for (int i = 0; i < param.layer_size(); ++i) {
+    param.mutable_layer(i)->clear_checkpoint();
+  }
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> reference_net(param);
+  Caffe::set_random_seed(this->seed_);
+  const Dtype loss = checkpoint_net.ForwardBackward();
+  Caffe::set_random_seed(this->seed_);
+  const Dtype reference_loss = reference_net.ForwardBackward();
+  EXPECT_NEAR(reference_loss, loss, 1e-5);
+  const vector<shared_ptr<Blob<Dtype> > >& params = checkpoint_net.params();
+  const vector<shared_ptr<Blob<Dtype> > >& reference_params =
+      reference_net.params();
+  ASSERT_EQ(reference_params.size(), params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_NEAR(reference_params[i]->cpu_diff()[j], params[i]->cpu_diff()[j],
+          1e-5);
+    }
+  }
+  // After Forward, the activations inside the segments are released while
+  // the checkpoints and the data are kept.
+  checkpoint_net.Forward();
+  EXPECT_EQ(SyncedMemory::UNINITIALIZED,
+      checkpoint_net.blob_by_name("ip1")->data()->head());
+  EXPECT_EQ(SyncedMemory::UNINITIALIZED,
+      checkpoint_net.blob_by_name("sigmoid2")->data()->head());
+  EXPECT_NE(SyncedMemory::UNINITIALIZED,
+      checkpoint_net.blob_by_name("ip2")->data()->head());
+  EXPECT_NE(SyncedMemory::UNINITIALIZED,
+      checkpoint_net.blob_by_name("ip3")->data()->head());
+  EXPECT_NE(SyncedMemory::UNINITIALIZED,
+      checkpoint_net.blob_by_name("data")->data()->head());
+}
+
+TYPED_TEST(NetTest, TestCheckpointDropout) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The Dropout lies inside a segment, between activations that are released.
+  const string proto =
+      "name: 'CheckpointDropoutNetwork' "
+      "state { phase: TRAIN } "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  top: 'data' "
+      "  top: 'label' "
+      "  dummy_data_param { "
+      "    shape { dim: 4 dim: 5 } "
+      "    shape { dim: 4 dim: 3 } "
+      "    data_filler { type: 'gaussian' std: 1 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "  inner_product_param { "
+      "    num_output: 6 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  checkpoint: true "
+      "} "
+      "layer { "
+      "  name: 'sigmoid1' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'ip1' "
+      "  top: 'sigmoid1' "
+      "} "
+      "layer { "
+      "  name: 'drop1' "
+      "  type: 'Dropout' "
+      "  bottom: 'sigmoid1' "
+      "  top: 'drop1' "
+      "} "
+      "layer { "
+      "  name: 'sigmoid2' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'drop1' "
+      "  top: 'sigmoid2' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'sigmoid2' "
+      "  top: 'ip2' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "  checkpoint: true "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'ip2' "
+      "  bottom: 'label' "
+      "  top: 'loss' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> checkpoint_net(param);
+  for (int i = 0; i < param.layer_size(); ++i) {
+    param.mutable_layer(i)->clear_checkpoint();
+  }
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> reference_net(param);
+  // A rerun Dropout would draw a new mask for Backward.
+  Caffe::set_random_seed(this->seed_);
+  const Dtype loss = checkpoint_net.ForwardBackward();
+  Caffe::set_random_seed(this->seed_);
+  const Dtype reference_loss = reference_net.ForwardBackward();
+  EXPECT_NEAR(reference_loss, loss, 1e-5);
+  const vector<shared_ptr<Blob<Dtype> > >& params = checkpoint_net.params();
+  const vector<shared_ptr<Blob<Dtype> > >& reference_params =
+      reference_net.params();
+  ASSERT_EQ(reference_params.size(), params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_NEAR(reference_params[i]->cpu_diff()[j], params[i]->cpu_diff()[j],
+          1e-5);
+    }
+  }
+  // The top of the Dropout is kept, the activations around it released.
+  checkpoint_net.Forward();
+  EXPECT_EQ(SyncedMemory::UNINITIALIZED,
+      checkpoint_net.blob_by_name("sigmoid1")->data()->head());
+  EXPECT_NE(SyncedMemory::UNINITIALIZED,
+      checkpoint_net.blob_by_name("drop1")->data()->head());
+  EXPECT_EQ(SyncedMemory::UNINITIALIZED,
+      checkpoint_net.blob_by_name("sigmoid2")->data()->head());
+}
+
+TYPED_TEST(NetTest, TestMapTrainedLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'MappedWeightsNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 5 dim: 5 } } "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'conv' "
+      "  top: 'ip' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Net<Dtype> trained_net(param);
+  string weights_file;
+  MakeTempFilename(&weights_file);
+  trained_net.ToMappedWeights(weights_file);
+  // Initialized differently, then loaded through CopyTrainedLayersFrom.
+  Caffe::set_random_seed(this->seed_ + 1);
+  Net<Dtype> mapped_net(param);
+  mapped_net.CopyTrainedLayersFrom(weights_file);
+  const vector<shared_ptr<Blob<Dtype> > >& trained_params =
+      trained_net.params();
+  const vector<shared_ptr<Blob<Dtype> > >& mapped_params = mapped_net.params();
+  ASSERT_EQ(trained_params.size(), mapped_params.size());
+  for (int i = 0; i < trained_params.size(); ++i) {
+    ASSERT_TRUE(trained_params[i]->shape() == mapped_params[i]->shape());
+    for (int j = 0; j < trained_params[i]->count(); ++j) {
+      EXPECT_EQ(trained_params[i]->cpu_data()[j],
+                mapped_params[i]->cpu_data()[j]);
+    }
+  }
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(trained_net.input_blobs()[0]);
+  mapped_net.input_blobs()[0]->CopyFrom(*trained_net.input_blobs()[0]);
+  trained_net.Forward();
+  mapped_net.Forward();
+  const Blob<Dtype>* expected = trained_net.output_blobs()[0];
+  const Blob<Dtype>* actual = mapped_net.output_blobs()[0];
+  for (int i = 0; i < expected->count(); ++i) {
+    EXPECT_NEAR(expected->cpu_data()[i], actual->cpu_data()[i], 1e-5);
+  }
+}
+
+TYPED_TEST(NetTest, TestFoldInferenceLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'FoldNetwork' "
+      "state { phase: TEST } "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 6 dim: 5 } } "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    bias_term: false "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'bn' "
+      "  type: 'BatchNorm' "
+      "  bottom: 'conv' "
+      "  top: 'bn' "
+      "} "
+      "layer { "
+      "  name: 'scale' "
+      "  type: 'Scale' "
+      "  bottom: 'bn' "
+      "  top: 'bn' "
+      "  scale_param { "
+      "    bias_term: true "
+      "    filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'relu' "
+      "  type: 'ReLU' "
+      "  bottom: 'bn' "
+      "  top: 'bn' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Net<Dtype> net(param);
+  // Moving averages of the statistics, stored scaled by a factor of 2.
+  const vector<shared_ptr<Blob<Dtype> > >& stats =
+      net.layer_by_name("bn")->blobs();
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(stats[0].get());
+  filler.Fill(stats[1].get());
+  for (int c = 0; c < stats[1]->count(); ++c) {
+    stats[1]->mutable_cpu_data()[c] =
+        2 * (std::abs(stats[1]->cpu_data()[c]) + 0.5);
+  }
+  stats[2]->mutable_cpu_data()[0] = 2;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const vector<shared_ptr<Blob<Dtype> > >& blobs =
+        net.layer_by_name(param.layer(i).name())->blobs();
+    for (int j = 0; j < blobs.size(); ++j) {
+      blobs[j]->ToProto(param.mutable_layer(i)->add_blobs());
+    }
+  }
+  NetParameter folded_param;
+  FoldInferenceLayers(param, &folded_param);
+  ASSERT_EQ(2, folded_param.layer_size());
+  const LayerParameter& conv_param = folded_param.layer(1);
+  EXPECT_EQ("bn", conv_param.top(0));
+  EXPECT_TRUE(conv_param.convolution_param().bias_term());
+  EXPECT_TRUE(conv_param.convolution_param().fused_relu());
+  Net<Dtype> folded_net(folded_param);
+  folded_net.CopyTrainedLayersFrom(folded_param);
+  filler.Fill(net.input_blobs()[0]);
+  folded_net.input_blobs()[0]->CopyFrom(*net.input_blobs()[0]);
+  net.Forward();
+  folded_net.Forward();
+  const Blob<Dtype>* expected = net.output_blobs()[0];
+  const Blob<Dtype>* actual = folded_net.output_blobs()[0];
+  ASSERT_TRUE(expected->shape() == actual->shape());
+  for (int i = 0; i < expected->count(); ++i) {
+    EXPECT_NEAR(expected->cpu_data()[i], actual->cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(NetTest, TestFoldInferenceLayersAfterInPlace) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The Scale reads the convolution output after the BatchNorm overwrote it
+  // in place, and writes a new top that the ReLU then overwrites in place.
+  const string proto =
+      "name: 'FoldNetwork' "
+      "state { phase: TEST } "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 6 dim: 5 } } "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'bn' "
+      "  type: 'BatchNorm' "
+      "  bottom: 'conv' "
+      "  top: 'conv' "
+      "} "
+      "layer { "
+      "  name: 'scale' "
+      "  type: 'Scale' "
+      "  bottom: 'conv' "
+      "  top: 'scale' "
+      "  scale_param { "
+      "    bias_term: true "
+      "    filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'gaussian' std: 0.5 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'relu' "
+      "  type: 'ReLU' "
+      "  bottom: 'scale' "
+      "  top: 'scale' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Net<Dtype> net(param);
+  const vector<shared_ptr<Blob<Dtype> > >& stats =
+      net.layer_by_name("bn")->blobs();
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(stats[0].get());
+  filler.Fill(stats[1].get());
+  for (int c = 0; c < stats[1]->count(); ++c) {
+    stats[1]->mutable_cpu_data()[c] = std::abs(stats[1]->cpu_data()[c]) + 0.5;
+  }
+  stats[2]->mutable_cpu_data()[0] = 1;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const vector<shared_ptr<Blob<Dtype> > >& blobs =
+        net.layer_by_name(param.layer(i).name())->blobs();
+    for (int j = 0; j < blobs.size(); ++j) {
+      blobs[j]->ToProto(param.mutable_layer(i)->add_blobs());
+    }
+  }
+  NetParameter folded_param;
+  FoldInferenceLayers(param, &folded_param);
+  ASSERT_EQ(2, folded_param.layer_size());
+  const LayerParameter& conv_param = folded_param.layer(1);
+  EXPECT_EQ("scale", conv_param.top(0));
+  EXPECT_TRUE(conv_param.convolution_param().fused_relu());
+  Net<Dtype> folded_net(folded_param);
+  folded_net.CopyTrainedLayersFrom(folded_param);
+  filler.Fill(net.input_blobs()[0]);
+  folded_net.input_blobs()[0]->CopyFrom(*net.input_blobs()[0]);
+  net.Forward();
+  folded_net.Forward();
+  const Blob<Dtype>* expected = net.output_blobs()[0];
+  const Blob<Dtype>* actual = folded_net.output_blobs()[0];
+  ASSERT_TRUE(expected->shape() == actual->shape());
+  for (int i = 0; i < expected->count(); ++i) {
+    EXPECT_NEAR(expected->cpu_data()[i], actual->cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(NetTest, TestFuseElementwise) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Each channel of the inputs spans more than one tile.
+  const string proto =
+      "name: 'FuseNetwork' "
+      "state { phase: TEST } "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'a' "
+      "  top: 'b' "
+      "  input_param { "
+      "    shape { dim: 2 dim: 3 dim: 40 dim: 120 } "
+      "    shape { dim: 2 dim: 3 dim: 40 dim: 120 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'sum' "
+      "  type: 'Eltwise' "
+      "  bottom: 'a' "
+      "  bottom: 'b' "
+      "  top: 'sum' "
+      "  eltwise_param { operation: SUM coeff: 0.5 coeff: -2 } "
+      "} "
+      "layer { "
+      "  name: 'relu' "
+      "  type: 'ReLU' "
+      "  bottom: 'sum' "
+      "  top: 'sum' "
+      "  relu_param { negative_slope: 0.1 } "
+      "} "
+      "layer { "
+      "  name: 'scale' "
+      "  type: 'Scale' "
+      "  bottom: 'sum' "
+      "  top: 'scale' "
+      "  scale_param { "
+      "    bias_term: true "
+      "    filler { type: 'gaussian' } "
+      "    bias_filler { type: 'gaussian' } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'sigmoid' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'scale' "
+      "  top: 'scale' "
+      "} "
+      "layer { "
+      "  name: 'power' "
+      "  type: 'Power' "
+      "  bottom: 'scale' "
+      "  top: 'power' "
+      "  power_param { power: 2 scale: 3 shift: -1 } "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Net<Dtype> net(param);
+  NetParameter trained_param;
+  net.ToProto(&trained_param);
+  param.set_fuse_elementwise(true);
+  Net<Dtype> fused_net(param);
+  fused_net.CopyTrainedLayersFrom(trained_param);
+  ASSERT_EQ(3, fused_net.layers().size());
+  EXPECT_STREQ("FusedElementwise", fused_net.layers()[1]->type());
+  EXPECT_STREQ("FusedElementwise", fused_net.layers()[2]->type());
+  EXPECT_EQ("scale", fused_net.layer_names()[2]);
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int i = 0; i < net.input_blobs().size(); ++i) {
+    filler.Fill(net.input_blobs()[i]);
+    fused_net.input_blobs()[i]->CopyFrom(*net.input_blobs()[i]);
+  }
+  net.Forward();
+  fused_net.Forward();
+  const Blob<Dtype>* expected = net.output_blobs()[0];
+  const Blob<Dtype>* actual = fused_net.output_blobs()[0];
+  ASSERT_TRUE(expected->shape() == actual->shape());
+  for (int i = 0; i < expected->count(); ++i) {
+    EXPECT_NEAR(expected->cpu_data()[i], actual->cpu_data()[i], 1e-4);
+  }
+}
+
 TYPED_TEST(NetTest, TestSkipPropagateDown) {
   // check bottom_need_backward if propagate_down is true
   this->InitSkipPropNet(false);
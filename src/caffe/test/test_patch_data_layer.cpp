@@ -0,0 +1,206 @@
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "hdf5.h"
+#include "hdf5_hl.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layers/patch_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Shape of the test volume.
+static const int kChannels = 2;
+static const int kDepth = 6;
+static const int kHeight = 7;
+static const int kWidth = 8;
+
+template <typename TypeParam>
+class PatchDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  PatchDataLayerTest()
+      : seed_(1701),
+        blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+    Caffe::set_random_seed(seed_);
+    // A C x D x H x W volume whose voxels hold their index, labelled 1 in a
+    // 2 x 2 x 2 cube and 0 elsewhere.
+    const int spatial_dim = kDepth * kHeight * kWidth;
+    data_.resize(kChannels * spatial_dim);
+    for (int i = 0; i < data_.size(); ++i) {
+      data_[i] = i;
+    }
+    label_.assign(spatial_dim, 0);
+    for (int z = 3; z < 5; ++z) {
+      for (int y = 1; y < 3; ++y) {
+        for (int x = 5; x < 7; ++x) {
+          label_[(z * kHeight + y) * kWidth + x] = 1;
+        }
+      }
+    }
+    // Raw files.
+    string data_file, label_file;
+    MakeTempFilename(&data_file);
+    MakeTempFilename(&label_file);
+    std::ofstream data_out(data_file.c_str(), std::ofstream::binary);
+    data_out.write(reinterpret_cast<const char*>(data_.data()),
+        data_.size() * sizeof(float));
+    data_out.close();
+    std::ofstream label_out(label_file.c_str(), std::ofstream::binary);
+    label_out.write(reinterpret_cast<const char*>(label_.data()),
+        label_.size());
+    label_out.close();
+    MakeTempFilename(&raw_source_);
+    std::ofstream raw_source(raw_source_.c_str(), std::ofstream::out);
+    raw_source << data_file << " " << label_file << " " << kChannels << " "
+        << kDepth << " " << kHeight << " " << kWidth << std::endl;
+    raw_source.close();
+    // HDF5 file.
+    string hdf5_file;
+    MakeTempFilename(&hdf5_file);
+    hid_t file_id = H5Fcreate(hdf5_file.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
+        H5P_DEFAULT);
+    ASSERT_GE(file_id, 0);
+    hsize_t dims[4] = { kChannels, kDepth, kHeight, kWidth };
+    ASSERT_GE(H5LTmake_dataset_float(file_id, "data", 4, dims, data_.data()),
+        0);
+    ASSERT_GE(H5LTmake_dataset(file_id, "label", 3, dims + 1,
+        H5T_NATIVE_UINT8, label_.data()), 0);
+    ASSERT_GE(H5Fclose(file_id), 0);
+    MakeTempFilename(&hdf5_source_);
+    std::ofstream hdf5_source(hdf5_source_.c_str(), std::ofstream::out);
+    hdf5_source << hdf5_file << std::endl;
+    hdf5_source.close();
+  }
+
+  virtual ~PatchDataLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_label_;
+  }
+
+  void TestRead(const string& source, PatchDataParameter::Format format) {
+    const int batch_size = 6;
+    const int patch[3] = { 3, 4, 5 };
+    const int label_patch[3] = { 1, 2, 3 };
+    LayerParameter param;
+    PatchDataParameter* patch_data_param = param.mutable_patch_data_param();
+    patch_data_param->set_source(source.c_str());
+    patch_data_param->set_format(format);
+    patch_data_param->set_batch_size(batch_size);
+    patch_data_param->set_fg_fraction(0.5);
+    patch_data_param->set_sample_threads(2);
+    for (int i = 0; i < 3; ++i) {
+      patch_data_param->add_patch_shape(patch[i]);
+      patch_data_param->add_label_shape(label_patch[i]);
+    }
+    PatchDataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    EXPECT_EQ(blob_top_data_->num_axes(), 5);
+    EXPECT_EQ(blob_top_data_->shape(0), batch_size);
+    EXPECT_EQ(blob_top_data_->shape(1), kChannels);
+    EXPECT_EQ(blob_top_label_->shape(1), 1);
+    for (int i = 0; i < 3; ++i) {
+      EXPECT_EQ(blob_top_data_->shape(i + 2), patch[i]);
+      EXPECT_EQ(blob_top_label_->shape(i + 2), label_patch[i]);
+    }
+    const int spatial_dim = kDepth * kHeight * kWidth;
+    const int shape[3] = { kDepth, kHeight, kWidth };
+    for (int iter = 0; iter < 5; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int n = 0; n < batch_size; ++n) {
+        // The center voxel of the patch is inside the volume and gives the
+        // position of the patch.
+        vector<int> center_index(5, 0);
+        center_index[0] = n;
+        for (int i = 0; i < 3; ++i) {
+          center_index[i + 2] = patch[i] / 2;
+        }
+        const int center = static_cast<int>(
+            blob_top_data_->data_at(center_index));
+        ASSERT_GE(center, 0);
+        ASSERT_LT(center, spatial_dim);
+        EXPECT_EQ(n < batch_size / 2 ? 1 : 0, label_[center]);
+        const int origin[3] = {
+            center / (kHeight * kWidth) - patch[0] / 2,
+            center / kWidth % kHeight - patch[1] / 2,
+            center % kWidth - patch[2] / 2 };
+        int offset = 0;
+        for (int c = 0; c < kChannels; ++c) {
+          for (int z = 0; z < patch[0]; ++z) {
+            for (int y = 0; y < patch[1]; ++y) {
+              for (int x = 0; x < patch[2]; ++x, ++offset) {
+                const int position[3] = {
+                    origin[0] + z, origin[1] + y, origin[2] + x };
+                bool inside = true;
+                for (int i = 0; i < 3; ++i) {
+                  inside = inside && position[i] >= 0 &&
+                      position[i] < shape[i];
+                }
+                const int index = ((c * kDepth + position[0]) * kHeight +
+                    position[1]) * kWidth + position[2];
+                EXPECT_EQ(inside ? data_[index] : 0,
+                    blob_top_data_->cpu_data()[n * blob_top_data_->count(1) +
+                        offset]);
+              }
+            }
+          }
+        }
+        offset = 0;
+        for (int z = 0; z < label_patch[0]; ++z) {
+          for (int y = 0; y < label_patch[1]; ++y) {
+            for (int x = 0; x < label_patch[2]; ++x, ++offset) {
+              const int position[3] = {
+                  origin[0] + (patch[0] - label_patch[0]) / 2 + z,
+                  origin[1] + (patch[1] - label_patch[1]) / 2 + y,
+                  origin[2] + (patch[2] - label_patch[2]) / 2 + x };
+              bool inside = true;
+              for (int i = 0; i < 3; ++i) {
+                inside = inside && position[i] >= 0 && position[i] < shape[i];
+              }
+              const int index = (position[0] * kHeight + position[1]) *
+                  kWidth + position[2];
+              EXPECT_EQ(inside ? label_[index] : 0,
+                  blob_top_label_->cpu_data()[
+                      n * blob_top_label_->count(1) + offset]);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  int seed_;
+  vector<float> data_;
+  vector<uint8_t> label_;
+  string raw_source_;
+  string hdf5_source_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(PatchDataLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(PatchDataLayerTest, TestReadRaw) {
+  this->TestRead(this->raw_source_, PatchDataParameter::RAW);
+}
+
+TYPED_TEST(PatchDataLayerTest, TestReadHDF5) {
+  this->TestRead(this->hdf5_source_, PatchDataParameter::HDF5);
+}
+
+}  // namespace caffe
@@ -609,6 +609,153 @@ TYPED_TEST(PoolingLayerTest, TestGradientAvePadded) {
   }
 }
 
+TYPED_TEST(PoolingLayerTest, TestSetupND) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->add_kernel_nd(2);
+  pooling_param->add_kernel_nd(3);
+  pooling_param->add_kernel_nd(3);
+  pooling_param->add_stride_nd(2);
+  pooling_param->add_pad_nd(0);
+  pooling_param->add_pad_nd(1);
+  pooling_param->add_pad_nd(0);
+  vector<int> bottom_shape(5);
+  bottom_shape[0] = 2;
+  bottom_shape[1] = 3;
+  bottom_shape[2] = 5;
+  bottom_shape[3] = 6;
+  bottom_shape[4] = 5;
+  this->blob_bottom_->Reshape(bottom_shape);
+  PoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  ASSERT_EQ(this->blob_top_->num_axes(), 5);
+  EXPECT_EQ(this->blob_top_->shape(0), 2);
+  EXPECT_EQ(this->blob_top_->shape(1), 3);
+  EXPECT_EQ(this->blob_top_->shape(2), 3);
+  EXPECT_EQ(this->blob_top_->shape(3), 4);
+  EXPECT_EQ(this->blob_top_->shape(4), 2);
+}
+
+TYPED_TEST(PoolingLayerTest, TestForwardMaxND) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->add_kernel_nd(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  vector<int> bottom_shape(5, 3);
+  bottom_shape[0] = 1;
+  bottom_shape[1] = 2;
+  this->blob_bottom_->Reshape(bottom_shape);
+  // Each channel holds its own (d * 3 + h) * 3 + w index, so the maximum of
+  // a 2x2x2 window is at its far corner.
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    this->blob_bottom_->mutable_cpu_data()[i] = i % 27;
+  }
+  this->blob_top_vec_.push_back(this->blob_top_mask_);
+  PoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  ASSERT_EQ(this->blob_top_->count(), 16);
+  for (int c = 0; c < 2; ++c) {
+    for (int d = 0; d < 2; ++d) {
+      for (int h = 0; h < 2; ++h) {
+        for (int w = 0; w < 2; ++w) {
+          const int index = ((c * 2 + d) * 2 + h) * 2 + w;
+          const Dtype expected = ((d + 1) * 3 + h + 1) * 3 + w + 1;
+          EXPECT_EQ(this->blob_top_->cpu_data()[index], expected);
+          EXPECT_EQ(this->blob_top_mask_->cpu_data()[index], expected);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(PoolingLayerTest, TestForwardAveND) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->add_kernel_nd(3);
+  pooling_param->add_pad_nd(1);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_AVE);
+  vector<int> bottom_shape(5, 3);
+  bottom_shape[0] = 1;
+  bottom_shape[1] = 1;
+  this->blob_bottom_->Reshape(bottom_shape);
+  FillerParameter filler_param;
+  filler_param.set_value(Dtype(2));
+  ConstantFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  PoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  ASSERT_EQ(this->blob_top_->count(), 27);
+  // The padded window always has 27 elements; count the ones inside.
+  Dtype epsilon = 1e-5;
+  for (int d = 0; d < 3; ++d) {
+    for (int h = 0; h < 3; ++h) {
+      for (int w = 0; w < 3; ++w) {
+        const int inside = (d == 1 ? 3 : 2) * (h == 1 ? 3 : 2) *
+            (w == 1 ? 3 : 2);
+        EXPECT_NEAR(this->blob_top_->cpu_data()[(d * 3 + h) * 3 + w],
+            2.0 * inside / 27, epsilon);
+      }
+    }
+  }
+}
+
+TYPED_TEST(PoolingLayerTest, TestGradientMaxND) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<int> bottom_shape(5);
+  bottom_shape[0] = 2;
+  bottom_shape[1] = 2;
+  bottom_shape[2] = 3;
+  bottom_shape[3] = 4;
+  bottom_shape[4] = 4;
+  this->blob_bottom_->Reshape(bottom_shape);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->add_kernel_nd(2);
+  pooling_param->add_kernel_nd(3);
+  pooling_param->add_kernel_nd(2);
+  pooling_param->add_stride_nd(1);
+  pooling_param->add_stride_nd(2);
+  pooling_param->add_stride_nd(2);
+  pooling_param->add_pad_nd(1);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+  PoolingLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-4, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(PoolingLayerTest, TestGradientAveND) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<int> bottom_shape(5);
+  bottom_shape[0] = 2;
+  bottom_shape[1] = 2;
+  bottom_shape[2] = 3;
+  bottom_shape[3] = 4;
+  bottom_shape[4] = 4;
+  this->blob_bottom_->Reshape(bottom_shape);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->add_kernel_nd(3);
+  pooling_param->add_stride_nd(2);
+  pooling_param->add_pad_nd(1);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_AVE);
+  PoolingLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
 #ifdef USE_CUDNN
 template <typename Dtype>
 class CuDNNPoolingLayerTest : public GPUDeviceTest<Dtype> {
@@ -0,0 +1,242 @@
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/fold_layers.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// The per-channel affine y = scale * x + shift of a BatchNorm (with global
+// statistics), Scale or Bias layer over channels, if layer is one.
+static bool ChannelAffine(const LayerParameter& layer, const int channels,
+    vector<double>* scale, vector<double>* shift) {
+  scale->assign(channels, 1.);
+  shift->assign(channels, 0.);
+  if (layer.type() == "BatchNorm") {
+    const BatchNormParameter& bn_param = layer.batch_norm_param();
+    if ((bn_param.has_use_global_stats() && !bn_param.use_global_stats()) ||
+        layer.blobs_size() != 3) {
+      return false;
+    }
+    Blob<float> mean, variance, factor;
+    mean.FromProto(layer.blobs(0));
+    variance.FromProto(layer.blobs(1));
+    factor.FromProto(layer.blobs(2));
+    if (mean.count() != channels || variance.count() != channels) {
+      return false;
+    }
+    // The statistics are stored scaled by the moving average factor.
+    const double stats_factor = factor.cpu_data()[0] == 0 ?
+        0 : 1. / factor.cpu_data()[0];
+    for (int c = 0; c < channels; ++c) {
+      const double inv_std = 1. / std::sqrt(
+          stats_factor * variance.cpu_data()[c] + bn_param.eps());
+      (*scale)[c] = inv_std;
+      (*shift)[c] = -stats_factor * mean.cpu_data()[c] * inv_std;
+    }
+    return true;
+  }
+  if (layer.type() == "Scale") {
+    const ScaleParameter& scale_param = layer.scale_param();
+    if (scale_param.axis() != 1 || scale_param.num_axes() != 1 ||
+        layer.blobs_size() != (scale_param.bias_term() ? 2 : 1)) {
+      return false;
+    }
+    Blob<float> gamma, beta;
+    gamma.FromProto(layer.blobs(0));
+    if (gamma.count() != channels) {
+      return false;
+    }
+    if (scale_param.bias_term()) {
+      beta.FromProto(layer.blobs(1));
+    }
+    for (int c = 0; c < channels; ++c) {
+      (*scale)[c] = gamma.cpu_data()[c];
+      (*shift)[c] = scale_param.bias_term() ? beta.cpu_data()[c] : 0;
+    }
+    return true;
+  }
+  if (layer.type() == "Bias") {
+    const BiasParameter& bias_param = layer.bias_param();
+    if (bias_param.axis() != 1 || bias_param.num_axes() != 1 ||
+        layer.blobs_size() != 1) {
+      return false;
+    }
+    Blob<float> beta;
+    beta.FromProto(layer.blobs(0));
+    if (beta.count() != channels) {
+      return false;
+    }
+    for (int c = 0; c < channels; ++c) {
+      (*shift)[c] = beta.cpu_data()[c];
+    }
+    return true;
+  }
+  return false;
+}
+
+// Whether no layer after layer_id reads blob_name, so that layer_id may be
+// merged into the layer producing it even when it does not compute in place.
+static bool IsLastReader(const NetParameter& param, const int layer_id,
+    const string& blob_name) {
+  for (int i = layer_id + 1; i < param.layer_size(); ++i) {
+    for (int j = 0; j < param.layer(i).bottom_size(); ++j) {
+      if (param.layer(i).bottom(j) == blob_name) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void FoldInferenceLayers(const NetParameter& param,
+    NetParameter* param_folded) {
+  param_folded->CopyFrom(param);
+  param_folded->clear_layer();
+  for (int i = 0; i < param.layer_size(); ++i) {
+    LayerParameter* layer_param = param_folded->add_layer();
+    layer_param->CopyFrom(param.layer(i));
+    const ConvolutionParameter& conv_param = layer_param->convolution_param();
+    if (layer_param->type() != "Convolution" ||
+        layer_param->top_size() != 1 || conv_param.axis() != 1 ||
+        conv_param.fused_relu() ||
+        layer_param->blobs_size() != (conv_param.bias_term() ? 2 : 1)) {
+      continue;
+    }
+    Blob<float> weights, bias;
+    weights.FromProto(layer_param->blobs(0));
+    const int channels = weights.shape(0);
+    const int weight_dim = weights.count() / channels;
+    if (conv_param.bias_term()) {
+      bias.FromProto(layer_param->blobs(1));
+    } else {
+      bias.Reshape(vector<int>(1, channels));
+      caffe_set(channels, 0.f, bias.mutable_cpu_data());
+    }
+    bool folded = false;
+    bool fused_relu = false;
+    vector<double> scale, shift;
+    while (i + 1 < param.layer_size() && !fused_relu) {
+      // A layer that does not compute in place may only be folded away if
+      // it is the last reader of the convolution output: the layers folded
+      // before it in place read it too.
+      const LayerParameter& next = param.layer(i + 1);
+      if (next.bottom_size() != 1 || next.top_size() != 1 ||
+          next.bottom(0) != layer_param->top(0) ||
+          (next.top(0) != next.bottom(0) &&
+           !IsLastReader(param, i + 1, next.bottom(0)))) {
+        break;
+      }
+      if (next.type() == "ReLU") {
+        if (next.relu_param().negative_slope() != 0) {
+          break;
+        }
+        fused_relu = true;
+      } else if (ChannelAffine(next, channels, &scale, &shift)) {
+        float* weight_data = weights.mutable_cpu_data();
+        float* bias_data = bias.mutable_cpu_data();
+        for (int c = 0; c < channels; ++c) {
+          for (int k = 0; k < weight_dim; ++k) {
+            weight_data[c * weight_dim + k] *= scale[c];
+          }
+          bias_data[c] = scale[c] * bias_data[c] + shift[c];
+        }
+        folded = true;
+      } else {
+        break;
+      }
+      LOG(INFO) << "Folding " << next.type() << " layer " << next.name()
+                << " into " << layer_param->name();
+      layer_param->set_top(0, next.top(0));
+      ++i;
+    }
+    if (folded) {
+      layer_param->mutable_convolution_param()->set_bias_term(true);
+      layer_param->clear_blobs();
+      weights.ToProto(layer_param->add_blobs());
+      bias.ToProto(layer_param->add_blobs());
+    }
+    if (fused_relu) {
+      layer_param->mutable_convolution_param()->set_fused_relu(true);
+    }
+  }
+}
+
+bool ContinuesElementwiseChain(const LayerParameter& param) {
+  const string& type = param.type();
+  return param.bottom_size() == 1 && param.top_size() == 1 &&
+      param.loss_weight_size() == 0 &&
+      (type == "ReLU" || type == "Sigmoid" || type == "TanH" ||
+       type == "AbsVal" || type == "Power" || type == "ELU");
+}
+
+bool StartsElementwiseChain(const LayerParameter& param) {
+  if (param.top_size() != 1 || param.loss_weight_size() != 0) {
+    return false;
+  }
+  if (param.type() == "Eltwise") {
+    // The inputs are combined a tile at a time, so none may be overwritten.
+    for (int i = 0; i < param.bottom_size(); ++i) {
+      if (param.bottom(i) == param.top(0)) {
+        return false;
+      }
+    }
+    return param.bottom_size() >= 2;
+  }
+  if (param.type() == "Scale") {
+    return param.bottom_size() == 1 && param.scale_param().axis() == 1 &&
+        param.scale_param().num_axes() == 1;
+  }
+  if (param.type() == "Bias") {
+    return param.bottom_size() == 1 && param.bias_param().axis() == 1 &&
+        param.bias_param().num_axes() == 1;
+  }
+  return ContinuesElementwiseChain(param);
+}
+
+void FuseElementwiseLayers(const NetParameter& param,
+    NetParameter* param_fused) {
+  param_fused->CopyFrom(param);
+  param_fused->clear_layer();
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    int end = i + 1;
+    if (StartsElementwiseChain(layer_param)) {
+      string top = layer_param.top(0);
+      while (end < param.layer_size() &&
+          ContinuesElementwiseChain(param.layer(end)) &&
+          param.layer(end).bottom(0) == top &&
+          (param.layer(end).top(0) == top ||
+           IsLastReader(param, end, top))) {
+        top = param.layer(end).top(0);
+        ++end;
+      }
+    }
+    if (end == i + 1) {
+      param_fused->add_layer()->CopyFrom(layer_param);
+      continue;
+    }
+    LayerParameter* fused_param = param_fused->add_layer();
+    fused_param->set_name(layer_param.name());
+    fused_param->set_type("FusedElementwise");
+    fused_param->mutable_bottom()->CopyFrom(layer_param.bottom());
+    fused_param->add_top(param.layer(end - 1).top(0));
+    if (layer_param.has_phase()) {
+      fused_param->set_phase(layer_param.phase());
+    }
+    fused_param->mutable_param()->CopyFrom(layer_param.param());
+    fused_param->mutable_blobs()->CopyFrom(layer_param.blobs());
+    for (int j = i; j < end; ++j) {
+      LOG(INFO) << "Fusing " << param.layer(j).type() << " layer "
+                << param.layer(j).name() << " into " << layer_param.name();
+      fused_param->mutable_fused_elementwise_param()->add_layer()->CopyFrom(
+          param.layer(j));
+    }
+    i = end - 1;
+  }
+}
+
+}  // namespace caffe
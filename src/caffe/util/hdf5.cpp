@@ -3,13 +3,22 @@
 #include <string>
 #include <vector>
 
+#include "boost/thread/recursive_mutex.hpp"
+
 namespace caffe {
 
+static boost::recursive_mutex hdf5_mutex_;
+
+boost::recursive_mutex& hdf5_mutex() {
+  return hdf5_mutex_;
+}
+
 // Verifies format of data stored in HDF5 file and reshapes blob accordingly.
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
     Blob<Dtype>* blob, bool reshape) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   // Verify that the dataset exists.
   CHECK(H5LTfind_dataset(file_id, dataset_name_))
       << "Failed to find HDF5 dataset " << dataset_name_;
@@ -86,6 +95,7 @@ void hdf5_load_nd_dataset_helper(
 template <>
 void hdf5_load_nd_dataset<float>(hid_t file_id, const char* dataset_name_,
         int min_dim, int max_dim, Blob<float>* blob, bool reshape) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   hdf5_load_nd_dataset_helper(file_id, dataset_name_, min_dim, max_dim, blob,
                               reshape);
   herr_t status = H5LTread_dataset_float(
@@ -96,6 +106,7 @@ void hdf5_load_nd_dataset<float>(hid_t file_id, const char* dataset_name_,
 template <>
 void hdf5_load_nd_dataset<double>(hid_t file_id, const char* dataset_name_,
         int min_dim, int max_dim, Blob<double>* blob, bool reshape) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   hdf5_load_nd_dataset_helper(file_id, dataset_name_, min_dim, max_dim, blob,
                               reshape);
   herr_t status = H5LTread_dataset_double(
@@ -103,10 +114,68 @@ void hdf5_load_nd_dataset<double>(hid_t file_id, const char* dataset_name_,
   CHECK_GE(status, 0) << "Failed to read double dataset " << dataset_name_;
 }
 
+template <typename Dtype>
+static void hdf5_load_nd_dataset_rows_helper(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+    hsize_t row_begin, int num_rows, Blob<Dtype>* blob, hid_t mem_type) {
+  vector<int> blob_dims = hdf5_get_dataset_shape(file_id, dataset_name_);
+  CHECK_GE(blob_dims.size(), min_dim);
+  CHECK_LE(blob_dims.size(), max_dim);
+  CHECK_GE(blob_dims.size(), 1);
+  CHECK_LE(row_begin + num_rows, blob_dims[0])
+      << "Rows out of range for HDF5 dataset " << dataset_name_;
+  blob_dims[0] = num_rows;
+  blob->Reshape(blob_dims);
+
+  hid_t dataset_id = H5Dopen2(file_id, dataset_name_, H5P_DEFAULT);
+  CHECK_GE(dataset_id, 0) << "Failed to open HDF5 dataset " << dataset_name_;
+  hid_t type_id = H5Dget_type(dataset_id);
+  const H5T_class_t class_ = H5Tget_class(type_id);
+  H5Tclose(type_id);
+  CHECK(class_ == H5T_FLOAT || class_ == H5T_INTEGER)
+      << "Unsupported datatype class for " << dataset_name_;
+  hid_t file_space = H5Dget_space(dataset_id);
+  std::vector<hsize_t> start(blob_dims.size(), 0);
+  std::vector<hsize_t> count(blob_dims.size());
+  start[0] = row_begin;
+  for (int i = 0; i < blob_dims.size(); ++i) {
+    count[i] = blob_dims[i];
+  }
+  herr_t status = H5Sselect_hyperslab(file_space, H5S_SELECT_SET,
+      start.data(), NULL, count.data(), NULL);
+  CHECK_GE(status, 0) << "Failed to select rows of " << dataset_name_;
+  hid_t mem_space = H5Screate_simple(count.size(), count.data(), NULL);
+  status = H5Dread(dataset_id, mem_type, mem_space, file_space, H5P_DEFAULT,
+      blob->mutable_cpu_data());
+  CHECK_GE(status, 0) << "Failed to read rows of " << dataset_name_;
+  H5Sclose(mem_space);
+  H5Sclose(file_space);
+  H5Dclose(dataset_id);
+}
+
+template <>
+void hdf5_load_nd_dataset_rows<float>(hid_t file_id, const char* dataset_name_,
+    int min_dim, int max_dim, hsize_t row_begin, int num_rows,
+    Blob<float>* blob) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
+  hdf5_load_nd_dataset_rows_helper(file_id, dataset_name_, min_dim, max_dim,
+      row_begin, num_rows, blob, H5T_NATIVE_FLOAT);
+}
+
+template <>
+void hdf5_load_nd_dataset_rows<double>(hid_t file_id,
+    const char* dataset_name_, int min_dim, int max_dim, hsize_t row_begin,
+    int num_rows, Blob<double>* blob) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
+  hdf5_load_nd_dataset_rows_helper(file_id, dataset_name_, min_dim, max_dim,
+      row_begin, num_rows, blob, H5T_NATIVE_DOUBLE);
+}
+
 template <>
 void hdf5_save_nd_dataset<float>(
     const hid_t file_id, const string& dataset_name, const Blob<float>& blob,
     bool write_diff) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   int num_axes = blob.num_axes();
   hsize_t *dims = new hsize_t[num_axes];
   for (int i = 0; i < num_axes; ++i) {
@@ -128,6 +197,7 @@ template <>
 void hdf5_save_nd_dataset<double>(
     hid_t file_id, const string& dataset_name, const Blob<double>& blob,
     bool write_diff) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   int num_axes = blob.num_axes();
   hsize_t *dims = new hsize_t[num_axes];
   for (int i = 0; i < num_axes; ++i) {
@@ -145,7 +215,24 @@ void hdf5_save_nd_dataset<double>(
   delete[] dims;
 }
 
+vector<int> hdf5_get_dataset_shape(hid_t loc_id,
+    const string& dataset_name) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
+  CHECK(H5LTfind_dataset(loc_id, dataset_name.c_str()))
+      << "Failed to find HDF5 dataset " << dataset_name;
+  int ndims;
+  herr_t status = H5LTget_dataset_ndims(loc_id, dataset_name.c_str(), &ndims);
+  CHECK_GE(status, 0) << "Failed to get dataset ndims for " << dataset_name;
+  std::vector<hsize_t> dims(ndims);
+  status = H5LTget_dataset_info(
+      loc_id, dataset_name.c_str(), dims.data(), NULL, NULL);
+  CHECK_GE(status, 0) << "Failed to get dataset info for " << dataset_name;
+  vector<int> shape(dims.begin(), dims.end());
+  return shape;
+}
+
 string hdf5_load_string(hid_t loc_id, const string& dataset_name) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   // Get size of dataset
   size_t size;
   H5T_class_t class_;
@@ -163,6 +250,7 @@ string hdf5_load_string(hid_t loc_id, const string& dataset_name) {
 
 void hdf5_save_string(hid_t loc_id, const string& dataset_name,
                       const string& s) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   herr_t status = \
     H5LTmake_dataset_string(loc_id, dataset_name.c_str(), s.c_str());
   CHECK_GE(status, 0)
@@ -170,6 +258,7 @@ void hdf5_save_string(hid_t loc_id, const string& dataset_name,
 }
 
 int hdf5_load_int(hid_t loc_id, const string& dataset_name) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   int val;
   herr_t status = H5LTread_dataset_int(loc_id, dataset_name.c_str(), &val);
   CHECK_GE(status, 0)
@@ -178,6 +267,7 @@ int hdf5_load_int(hid_t loc_id, const string& dataset_name) {
 }
 
 void hdf5_save_int(hid_t loc_id, const string& dataset_name, int i) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   hsize_t one = 1;
   herr_t status = \
     H5LTmake_dataset_int(loc_id, dataset_name.c_str(), 1, &one, &i);
@@ -186,6 +276,7 @@ void hdf5_save_int(hid_t loc_id, const string& dataset_name, int i) {
 }
 
 int hdf5_get_num_links(hid_t loc_id) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   H5G_info_t info;
   herr_t status = H5Gget_info(loc_id, &info);
   CHECK_GE(status, 0) << "Error while counting HDF5 links.";
@@ -193,6 +284,7 @@ int hdf5_get_num_links(hid_t loc_id) {
 }
 
 string hdf5_get_name_by_idx(hid_t loc_id, int idx) {
+  boost::recursive_mutex::scoped_lock lock(hdf5_mutex());
   ssize_t str_size = H5Lget_name_by_idx(
       loc_id, ".", H5_INDEX_NAME, H5_ITER_NATIVE, idx, NULL, 0, H5P_DEFAULT);
   CHECK_GE(str_size, 0) << "Error retrieving HDF5 dataset at index " << idx;
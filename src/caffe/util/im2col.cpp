@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstring>
 #include <vector>
 
 #include "caffe/util/im2col.hpp"
@@ -15,6 +17,56 @@ inline bool is_a_ge_zero_and_a_lt_b(int a, int b) {
   return static_cast<unsigned>(a) < static_cast<unsigned>(b);
 }
 
+// The range [begin, end) of the output_w output columns whose input column
+// input_col + i * stride_w lies inside [0, width), so that the padding on
+// either side of an image row can be handled outside of the inner loop.
+inline void valid_col_range(const int width, const int output_w,
+    const int input_col, const int stride_w, int* begin, int* end) {
+  *begin = (input_col >= 0) ? 0 :
+      std::min(output_w, (stride_w - 1 - input_col) / stride_w);
+  *end = (input_col >= width) ? *begin : std::max(*begin,
+      std::min(output_w, (width - 1 - input_col) / stride_w + 1));
+}
+
+// Lower one row of output_w columns from the image row data_im, starting at
+// input_col; unit-stride rows are a single memcpy between the padded ends.
+template <typename Dtype>
+inline void im2col_row_cpu(const Dtype* data_im, const int width,
+    const int output_w, const int input_col, const int stride_w,
+    Dtype* data_col) {
+  int begin, end;
+  valid_col_range(width, output_w, input_col, stride_w, &begin, &end);
+  std::fill(data_col, data_col + begin, Dtype(0));
+  if (stride_w == 1) {
+    memcpy(data_col + begin, data_im + input_col + begin,
+        sizeof(Dtype) * (end - begin));
+  } else {
+    for (int i = begin; i < end; ++i) {
+      data_col[i] = data_im[input_col + i * stride_w];
+    }
+  }
+  std::fill(data_col + end, data_col + output_w, Dtype(0));
+}
+
+// The inverse of im2col_row_cpu: accumulate the row into the image row.
+template <typename Dtype>
+inline void col2im_row_cpu(const Dtype* data_col, const int width,
+    const int output_w, const int input_col, const int stride_w,
+    Dtype* data_im) {
+  int begin, end;
+  valid_col_range(width, output_w, input_col, stride_w, &begin, &end);
+  if (stride_w == 1) {
+    Dtype* im_row = data_im + input_col;
+    for (int i = begin; i < end; ++i) {
+      im_row[i] += data_col[i];
+    }
+  } else {
+    for (int i = begin; i < end; ++i) {
+      data_im[input_col + i * stride_w] += data_col[i];
+    }
+  }
+}
+
 template <typename Dtype>
 void im2col_cpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
@@ -37,15 +89,9 @@ void im2col_cpu(const Dtype* data_im, const int channels,
               *(data_col++) = 0;
             }
           } else {
-            int input_col = -pad_w + kernel_col * dilation_w;
-            for (int output_col = output_w; output_col; output_col--) {
-              if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
-                *(data_col++) = data_im[input_row * width + input_col];
-              } else {
-                *(data_col++) = 0;
-              }
-              input_col += stride_w;
-            }
+            im2col_row_cpu(data_im + input_row * width, width, output_w,
+                -pad_w + kernel_col * dilation_w, stride_w, data_col);
+            data_col += output_w;
           }
           input_row += stride_h;
         }
@@ -65,19 +111,187 @@ template void im2col_cpu<double>(const double* data_im, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, const int dilation_h, const int dilation_w,
     double* data_col);
+template void im2col_cpu<int8_t>(const int8_t* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    int8_t* data_col);
+
+// Core of im2col_3d_cpu/col2im_3d_cpu. A nonzero K fixes the kernel to K^3
+// at compile time so that the kernel loops can be unrolled; the caller has
+// checked that kernel_d == kernel_h == kernel_w == K. col2im accumulates.
+template <typename Dtype, int K>
+inline void im2col_3d_core_cpu(const Dtype* data_input, const bool im2col,
+    const int channels, const int depth, const int height, const int width,
+    const int kernel_d, const int kernel_h, const int kernel_w,
+    const int pad_d, const int pad_h, const int pad_w,
+    const int stride_d, const int stride_h, const int stride_w,
+    const int dilation_d, const int dilation_h, const int dilation_w,
+    Dtype* data_output) {
+  const int kd_size = K ? K : kernel_d;
+  const int kh_size = K ? K : kernel_h;
+  const int kw_size = K ? K : kernel_w;
+  const int output_d = (depth + 2 * pad_d -
+    (dilation_d * (kd_size - 1) + 1)) / stride_d + 1;
+  const int output_h = (height + 2 * pad_h -
+    (dilation_h * (kh_size - 1) + 1)) / stride_h + 1;
+  const int output_w = (width + 2 * pad_w -
+    (dilation_w * (kw_size - 1) + 1)) / stride_w + 1;
+  const int output_plane = output_h * output_w;
+  const int channel_size = depth * height * width;
+  int index_col = 0;
+  for (int channel = 0; channel < channels; ++channel) {
+    for (int kernel_dep = 0; kernel_dep < kd_size; ++kernel_dep) {
+      for (int kernel_row = 0; kernel_row < kh_size; ++kernel_row) {
+        for (int kernel_col = 0; kernel_col < kw_size; ++kernel_col) {
+          const int input_col = -pad_w + kernel_col * dilation_w;
+          int input_dep = -pad_d + kernel_dep * dilation_d;
+          for (int output_dep = output_d; output_dep; output_dep--) {
+            if (!is_a_ge_zero_and_a_lt_b(input_dep, depth)) {
+              // the whole output plane reads padding
+              if (im2col) {
+                std::fill(data_output + index_col,
+                    data_output + index_col + output_plane, Dtype(0));
+              }
+              index_col += output_plane;
+              input_dep += stride_d;
+              continue;
+            }
+            int input_row = -pad_h + kernel_row * dilation_h;
+            for (int output_row = output_h; output_row; output_row--) {
+              const int index_im = channel * channel_size +
+                  (input_dep * height + input_row) * width;
+              if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
+                if (im2col) {
+                  std::fill(data_output + index_col,
+                      data_output + index_col + output_w, Dtype(0));
+                }
+              } else if (im2col) {
+                im2col_row_cpu(data_input + index_im, width, output_w,
+                    input_col, stride_w, data_output + index_col);
+              } else {
+                col2im_row_cpu(data_input + index_col, width, output_w,
+                    input_col, stride_w, data_output + index_im);
+              }
+              index_col += output_w;
+              input_row += stride_h;
+            }
+            input_dep += stride_d;
+          }
+        }
+      }
+    }
+  }
+}
+
+// Dispatch to the specializations for the common 3x3x3, 5x5x5 and 7x7x7
+// kernels, and to the generic core otherwise.
+template <typename Dtype>
+inline void im2col_3d_dispatch_cpu(const Dtype* data_input, const bool im2col,
+    const int channels, const int depth, const int height, const int width,
+    const int kernel_d, const int kernel_h, const int kernel_w,
+    const int pad_d, const int pad_h, const int pad_w,
+    const int stride_d, const int stride_h, const int stride_w,
+    const int dilation_d, const int dilation_h, const int dilation_w,
+    Dtype* data_output) {
+  const int cube_kernel =
+      (kernel_d == kernel_h && kernel_h == kernel_w) ? kernel_d : 0;
+  switch (cube_kernel) {
+  case 3:
+    im2col_3d_core_cpu<Dtype, 3>(data_input, im2col, channels, depth, height,
+        width, kernel_d, kernel_h, kernel_w, pad_d, pad_h, pad_w, stride_d,
+        stride_h, stride_w, dilation_d, dilation_h, dilation_w, data_output);
+    break;
+  case 5:
+    im2col_3d_core_cpu<Dtype, 5>(data_input, im2col, channels, depth, height,
+        width, kernel_d, kernel_h, kernel_w, pad_d, pad_h, pad_w, stride_d,
+        stride_h, stride_w, dilation_d, dilation_h, dilation_w, data_output);
+    break;
+  case 7:
+    im2col_3d_core_cpu<Dtype, 7>(data_input, im2col, channels, depth, height,
+        width, kernel_d, kernel_h, kernel_w, pad_d, pad_h, pad_w, stride_d,
+        stride_h, stride_w, dilation_d, dilation_h, dilation_w, data_output);
+    break;
+  default:
+    im2col_3d_core_cpu<Dtype, 0>(data_input, im2col, channels, depth, height,
+        width, kernel_d, kernel_h, kernel_w, pad_d, pad_h, pad_w, stride_d,
+        stride_h, stride_w, dilation_d, dilation_h, dilation_w, data_output);
+  }
+}
+
+template <typename Dtype>
+void im2col_3d_cpu(const Dtype* data_im, const int channels,
+    const int depth, const int height, const int width,
+    const int kernel_d, const int kernel_h, const int kernel_w,
+    const int pad_d, const int pad_h, const int pad_w,
+    const int stride_d, const int stride_h, const int stride_w,
+    const int dilation_d, const int dilation_h, const int dilation_w,
+    Dtype* data_col) {
+  const bool kIm2Col = true;
+  im2col_3d_dispatch_cpu(data_im, kIm2Col, channels, depth, height, width,
+      kernel_d, kernel_h, kernel_w, pad_d, pad_h, pad_w, stride_d, stride_h,
+      stride_w, dilation_d, dilation_h, dilation_w, data_col);
+}
+
+// Explicit instantiation
+template void im2col_3d_cpu<float>(const float* data_im, const int channels,
+    const int depth, const int height, const int width,
+    const int kernel_d, const int kernel_h, const int kernel_w,
+    const int pad_d, const int pad_h, const int pad_w,
+    const int stride_d, const int stride_h, const int stride_w,
+    const int dilation_d, const int dilation_h, const int dilation_w,
+    float* data_col);
+template void im2col_3d_cpu<double>(const double* data_im, const int channels,
+    const int depth, const int height, const int width,
+    const int kernel_d, const int kernel_h, const int kernel_w,
+    const int pad_d, const int pad_h, const int pad_w,
+    const int stride_d, const int stride_h, const int stride_w,
+    const int dilation_d, const int dilation_h, const int dilation_w,
+    double* data_col);
+template void im2col_3d_cpu<int8_t>(const int8_t* data_im, const int channels,
+    const int depth, const int height, const int width,
+    const int kernel_d, const int kernel_h, const int kernel_w,
+    const int pad_d, const int pad_h, const int pad_w,
+    const int stride_d, const int stride_h, const int stride_w,
+    const int dilation_d, const int dilation_h, const int dilation_w,
+    int8_t* data_col);
+
+template <typename Dtype>
+void col2im_3d_cpu(const Dtype* data_col, const int channels,
+    const int depth, const int height, const int width,
+    const int kernel_d, const int kernel_h, const int kernel_w,
+    const int pad_d, const int pad_h, const int pad_w,
+    const int stride_d, const int stride_h, const int stride_w,
+    const int dilation_d, const int dilation_h, const int dilation_w,
+    Dtype* data_im) {
+  caffe_set(channels * depth * height * width, Dtype(0), data_im);
+  const bool kIm2Col = false;
+  im2col_3d_dispatch_cpu(data_col, kIm2Col, channels, depth, height, width,
+      kernel_d, kernel_h, kernel_w, pad_d, pad_h, pad_w, stride_d, stride_h,
+      stride_w, dilation_d, dilation_h, dilation_w, data_im);
+}
+
+// Explicit instantiation
+template void col2im_3d_cpu<float>(const float* data_col, const int channels,
+    const int depth, const int height, const int width,
+    const int kernel_d, const int kernel_h, const int kernel_w,
+    const int pad_d, const int pad_h, const int pad_w,
+    const int stride_d, const int stride_h, const int stride_w,
+    const int dilation_d, const int dilation_h, const int dilation_w,
+    float* data_im);
+template void col2im_3d_cpu<double>(const double* data_col, const int channels,
+    const int depth, const int height, const int width,
+    const int kernel_d, const int kernel_h, const int kernel_w,
+    const int pad_d, const int pad_h, const int pad_w,
+    const int stride_d, const int stride_h, const int stride_w,
+    const int dilation_d, const int dilation_h, const int dilation_w,
+    double* data_im);
 
 template <typename Dtype>
 inline void im2col_nd_core_cpu(const Dtype* data_input, const bool im2col,
     const int num_spatial_axes, const int* im_shape, const int* col_shape,
     const int* kernel_shape, const int* pad, const int* stride,
     const int* dilation, Dtype* data_output) {
-  if (!im2col) {
-    int im_size = im_shape[0];
-    for (int i = 0; i < num_spatial_axes; ++i) {
-      im_size *= im_shape[1 + i];
-    }
-    caffe_set(im_size, Dtype(0), data_output);
-  }
   int kernel_size = 1;
   for (int i = 0; i < num_spatial_axes; ++i) {
     kernel_size *= kernel_shape[i];
@@ -158,6 +372,11 @@ template void im2col_nd_cpu<double>(const double* data_im,
     const int* im_shape, const int* col_shape,
     const int* kernel_shape, const int* pad, const int* stride,
     const int* dilation, double* data_col);
+template void im2col_nd_cpu<int8_t>(const int8_t* data_im,
+    const int num_spatial_axes,
+    const int* im_shape, const int* col_shape,
+    const int* kernel_shape, const int* pad, const int* stride,
+    const int* dilation, int8_t* data_col);
 
 template <typename Dtype>
 void col2im_cpu(const Dtype* data_col, const int channels,
@@ -180,14 +399,10 @@ void col2im_cpu(const Dtype* data_col, const int channels,
           if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
             data_col += output_w;
           } else {
-            int input_col = -pad_w + kernel_col * dilation_w;
-            for (int output_col = output_w; output_col; output_col--) {
-              if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
-                data_im[input_row * width + input_col] += *data_col;
-              }
-              data_col++;
-              input_col += stride_w;
-            }
+            col2im_row_cpu(data_col, width, output_w,
+                -pad_w + kernel_col * dilation_w, stride_w,
+                data_im + input_row * width);
+            data_col += output_w;
           }
           input_row += stride_h;
         }
@@ -213,18 +428,44 @@ void col2im_nd_cpu(const Dtype* data_col, const int num_spatial_axes,
     const int* im_shape, const int* col_shape,
     const int* kernel_shape, const int* pad, const int* stride,
     const int* dilation, Dtype* data_im) {
+  int im_size = im_shape[0];
+  for (int i = 0; i < num_spatial_axes; ++i) {
+    im_size *= im_shape[1 + i];
+  }
+  caffe_set(im_size, Dtype(0), data_im);
+  col2im_nd_add_cpu(data_col, num_spatial_axes, im_shape, col_shape,
+                    kernel_shape, pad, stride, dilation, data_im);
+}
+
+// Explicit instantiation
+template void col2im_nd_cpu<float>(const float* data_col,
+    const int num_spatial_axes,
+    const int* im_shape, const int* col_shape,
+    const int* kernel_shape, const int* pad, const int* stride,
+    const int* dilation, float* data_im);
+template void col2im_nd_cpu<double>(const double* data_col,
+    const int num_spatial_axes,
+    const int* im_shape, const int* col_shape,
+    const int* kernel_shape, const int* pad, const int* stride,
+    const int* dilation, double* data_im);
+
+template <typename Dtype>
+void col2im_nd_add_cpu(const Dtype* data_col, const int num_spatial_axes,
+    const int* im_shape, const int* col_shape,
+    const int* kernel_shape, const int* pad, const int* stride,
+    const int* dilation, Dtype* data_im) {
   const bool kIm2Col = false;
   im2col_nd_core_cpu(data_col, kIm2Col, num_spatial_axes, im_shape, col_shape,
                      kernel_shape, pad, stride, dilation, data_im);
 }
 
 // Explicit instantiation
-template void col2im_nd_cpu<float>(const float* data_col,
+template void col2im_nd_add_cpu<float>(const float* data_col,
     const int num_spatial_axes,
     const int* im_shape, const int* col_shape,
     const int* kernel_shape, const int* pad, const int* stride,
     const int* dilation, float* data_im);
-template void col2im_nd_cpu<double>(const double* data_col,
+template void col2im_nd_add_cpu<double>(const double* data_col,
     const int num_spatial_axes,
     const int* im_shape, const int* col_shape,
     const int* kernel_shape, const int* pad, const int* stride,
@@ -0,0 +1,65 @@
+#include <algorithm>
+#include <cmath>
+
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/quantize.hpp"
+
+namespace caffe {
+
+// Blocking of caffe_cpu_gemm_int8: a kGemmInt8BlockK x kGemmInt8BlockN panel
+// of B (32 KB) stays in cache while every row of A is multiplied with it.
+static const int kGemmInt8BlockK = 128;
+static const int kGemmInt8BlockN = 256;
+
+template <typename Dtype>
+Dtype caffe_cpu_amax(const int n, const Dtype* x) {
+  Dtype amax = 0;
+  for (int i = 0; i < n; ++i) {
+    amax = std::max(amax, std::fabs(x[i]));
+  }
+  return amax;
+}
+
+template float caffe_cpu_amax<float>(const int n, const float* x);
+template double caffe_cpu_amax<double>(const int n, const double* x);
+
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype* x, const Dtype scale,
+    int8_t* y) {
+  const Dtype inv_scale = scale > 0 ? 1 / scale : 0;
+  for (int i = 0; i < n; ++i) {
+    const Dtype q = std::min(Dtype(127), std::max(Dtype(-127),
+        x[i] * inv_scale));
+    y[i] = static_cast<int8_t>(q < 0 ? q - Dtype(0.5) : q + Dtype(0.5));
+  }
+}
+
+template void caffe_cpu_quantize<float>(const int n, const float* x,
+    const float scale, int8_t* y);
+template void caffe_cpu_quantize<double>(const int n, const double* x,
+    const double scale, int8_t* y);
+
+void caffe_cpu_gemm_int8(const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, int32_t* C) {
+  caffe_set(M * N, 0, C);
+  for (int k0 = 0; k0 < K; k0 += kGemmInt8BlockK) {
+    const int k1 = std::min(K, k0 + kGemmInt8BlockK);
+    for (int n0 = 0; n0 < N; n0 += kGemmInt8BlockN) {
+      const int n1 = std::min(N, n0 + kGemmInt8BlockN);
+      for (int m = 0; m < M; ++m) {
+        int32_t* c = C + m * N;
+        for (int k = k0; k < k1; ++k) {
+          // Widened multiply-add over a unit-stride row, which compilers
+          // vectorize.
+          const int32_t a = A[m * K + k];
+          const int8_t* b = B + k * N;
+          for (int j = n0; j < n1; ++j) {
+            c[j] += a * b[j];
+          }
+        }
+      }
+    }
+  }
+}
+
+}  // namespace caffe
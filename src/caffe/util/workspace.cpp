@@ -0,0 +1,48 @@
+#include <boost/thread.hpp>
+
+#include "caffe/util/workspace.hpp"
+
+namespace caffe {
+
+struct WorkspaceBuffers {
+  shared_ptr<SyncedMemory> slots[Workspace::NUM_SLOTS];
+};
+
+// Make sure each thread has its own buffers.
+static boost::thread_specific_ptr<WorkspaceBuffers> thread_workspace_;
+
+static WorkspaceBuffers& workspace_buffers() {
+  if (!thread_workspace_.get()) {
+    thread_workspace_.reset(new WorkspaceBuffers());
+  }
+  return *thread_workspace_.get();
+}
+
+shared_ptr<SyncedMemory> Workspace::Get(const Slot slot, const size_t size) {
+  CHECK_GE(slot, 0);
+  CHECK_LT(slot, NUM_SLOTS);
+  shared_ptr<SyncedMemory>& buffer = workspace_buffers().slots[slot];
+  if (!buffer || buffer->size() < size) {
+    // Allocated lazily on first access, like any other SyncedMemory.
+    buffer.reset(new SyncedMemory(size));
+  }
+  return buffer;
+}
+
+size_t Workspace::size() {
+  size_t bytes = 0;
+  for (int slot = 0; slot < NUM_SLOTS; ++slot) {
+    if (workspace_buffers().slots[slot]) {
+      bytes += workspace_buffers().slots[slot]->size();
+    }
+  }
+  return bytes;
+}
+
+void Workspace::Release() {
+  for (int slot = 0; slot < NUM_SLOTS; ++slot) {
+    workspace_buffers().slots[slot].reset();
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,85 @@
+// This is a script to calibrate a net for int8 inference. It runs the net
+// (TEST phase, on its own data layers) for a number of iterations, records
+// the largest input magnitude of each Convolution and InnerProduct layer and
+// writes a copy of the prototxt with quantization_param.input_range set.
+// Usage:
+//    calibrate_int8 net_proto_file weights iterations net_proto_file_out
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/quantize.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+// Records the input ranges before each layer runs, as inputs are released
+// once consumed.
+class RangeRecorder : public Net<float>::Callback {
+ public:
+  explicit RangeRecorder(const Net<float>& net) : net_(net) {}
+  const std::map<string, float>& ranges() const { return ranges_; }
+
+ protected:
+  virtual void run(int layer) {
+    const string type = net_.layers()[layer]->type();
+    if (type != "Convolution" && type != "InnerProduct") {
+      return;
+    }
+    float& range = ranges_[net_.layer_names()[layer]];
+    const vector<Blob<float>*>& bottom = net_.bottom_vecs()[layer];
+    for (int i = 0; i < bottom.size(); ++i) {
+      range = std::max(range,
+          caffe_cpu_amax(bottom[i]->count(), bottom[i]->cpu_data()));
+    }
+  }
+
+  const Net<float>& net_;
+  std::map<string, float> ranges_;
+};
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: "
+        << "calibrate_int8 net_proto_file weights iterations "
+        << "net_proto_file_out";
+    return 1;
+  }
+
+  NetParameter param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &param);
+  // Calibrate the float layers.
+  NetParameter float_param(param);
+  float_param.mutable_state()->set_phase(TEST);
+  for (int i = 0; i < float_param.layer_size(); ++i) {
+    float_param.mutable_layer(i)->clear_quantization_param();
+  }
+  Net<float> net(float_param);
+  net.CopyTrainedLayersFrom(argv[2]);
+  RangeRecorder recorder(net);
+  net.add_before_forward(&recorder);
+  const int iterations = atoi(argv[3]);
+  for (int i = 0; i < iterations; ++i) {
+    net.Forward();
+  }
+
+  for (int i = 0; i < param.layer_size(); ++i) {
+    std::map<string, float>::const_iterator range =
+        recorder.ranges().find(param.layer(i).name());
+    if (range != recorder.ranges().end()) {
+      LOG(INFO) << "Input range of " << range->first << ": " << range->second;
+      param.mutable_layer(i)->mutable_quantization_param()->set_input_range(
+          range->second);
+    }
+  }
+  WriteProtoToTextFile(param, argv[4]);
+
+  LOG(INFO) << "Wrote calibrated net to " << argv[4];
+  return 0;
+}
@@ -0,0 +1,27 @@
+// This is a script to convert trained weights (.caffemodel or .h5) to the
+// flat file format that Net::CopyTrainedLayersFrom memory-maps.
+// Usage:
+//    convert_weights_to_mapped net_proto_file weights_in weights_out
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 4) {
+    LOG(ERROR) << "Usage: "
+        << "convert_weights_to_mapped net_proto_file weights_in weights_out";
+    return 1;
+  }
+
+  Net<float> net(argv[1], TEST);
+  net.CopyTrainedLayersFrom(argv[2]);
+  net.ToMappedWeights(argv[3]);
+
+  LOG(INFO) << "Wrote mapped weights to " << argv[3];
+  return 0;
+}
@@ -0,0 +1,56 @@
+// This is a script to optimize a trained net for inference. It folds the
+// BatchNorm, Scale and Bias layers that follow each Convolution into its
+// weights and bias and merges a following ReLU into it (fused_relu), then
+// writes the folded prototxt and weights.
+// Usage:
+//    fold_inference_net net_proto_file weights net_proto_file_out weights_out
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/fold_layers.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: "
+        << "fold_inference_net net_proto_file weights net_proto_file_out "
+        << "weights_out";
+    return 1;
+  }
+
+  NetParameter param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &param);
+  param.mutable_state()->set_phase(TEST);
+  NetParameter test_param;
+  Net<float>::FilterNet(param, &test_param);
+  Net<float> net(test_param);
+  net.CopyTrainedLayersFrom(argv[2]);
+  // Attach the trained blobs to the layers they belong to.
+  for (int i = 0; i < test_param.layer_size(); ++i) {
+    LayerParameter* layer_param = test_param.mutable_layer(i);
+    const vector<shared_ptr<Blob<float> > >& blobs =
+        net.layer_by_name(layer_param->name())->blobs();
+    for (int j = 0; j < blobs.size(); ++j) {
+      blobs[j]->ToProto(layer_param->add_blobs());
+    }
+  }
+
+  NetParameter folded_param;
+  FoldInferenceLayers(test_param, &folded_param);
+  LOG(INFO) << "Folded " << test_param.layer_size() << " layers into "
+            << folded_param.layer_size();
+  WriteProtoToBinaryFile(folded_param, argv[4]);
+  for (int i = 0; i < folded_param.layer_size(); ++i) {
+    folded_param.mutable_layer(i)->clear_blobs();
+  }
+  WriteProtoToTextFile(folded_param, argv[3]);
+
+  LOG(INFO) << "Wrote folded net to " << argv[3] << " and " << argv[4];
+  return 0;
+}